@@ -6,6 +6,7 @@
 #include "config.h"
 #include "net.h"
 #include "utils.h"
+#include "ethernet.h"
 #define ARP_HW_ETHER 0x1 // 以太网
 #define ARP_REQUEST 0x1  // ARP请求包
 #define ARP_REPLY 0x2    // ARP响应包
@@ -23,17 +24,44 @@ typedef struct arp_entry
     time_t timeout;           //超时时间戳
     uint8_t ip[NET_IP_LEN];   //ip地址
     uint8_t mac[NET_MAC_LEN]; //mac地址
+    uint32_t gen;             //代次，表项被改写或失效时加1，使已有的邻居句柄失效
+    uint8_t referenced;       //访问位，查找命中时置1，CLOCK淘汰经过时清0
+    net_if_t *nif;            //学到该表项的网络接口
+    ether_hdr_t hdr;          //预先构造好的发往该邻居的IP帧以太网头，源mac为nif的mac地址
 } arp_entry_t;
 
+/**
+ * @brief 邻居句柄，由持续向同一目的地址发送的发送者保存，发送时跳过arp表查找
+ *        全0的句柄无效，第一次发送时填写；表项被改写或失效后自动重新查找
+ * 
+ */
+typedef struct arp_neigh
+{
+    arp_entry_t *entry; //arp表项
+    uint32_t gen;       //填写句柄时表项的代次
+} arp_neigh_t;
+
+/**
+ * @brief arp表的统计计数
+ * 
+ */
+typedef struct arp_stats
+{
+    uint64_t hits;      //查找命中次数
+    uint64_t misses;    //查找未命中次数，包括找到已超时的表项
+    uint64_t evictions; //表满时淘汰未超时表项的次数
+    uint64_t expired;   //发现并删除超时表项的次数
+} arp_stats_t;
+
 typedef struct arp_buf
 {
     int valid;               //有效位
     buf_t buf;               //数据包
     uint8_t ip[NET_IP_LEN];  //目的ip地址
     net_protocol_t protocol; //上层协议
+    time_t req_time;         //最近一次发送arp请求的时间
 } arp_buf_t;
 
-#pragma pack(1)
 typedef struct arp_pkt
 {
     uint16_t hw_type, pro_type;      // 硬件类型和协议类型
@@ -44,8 +72,7 @@ typedef struct arp_pkt
     uint8_t target_mac[NET_MAC_LEN]; // 接收方硬件地址
     uint8_t target_ip[NET_IP_LEN];   // 接收方协议地址
 } arp_pkt_t;
-
-#pragma pack()
+_Static_assert(sizeof(arp_pkt_t) == 28, "arp_pkt_t must not be padded");
 
 /**
  * @brief 初始化arp协议
@@ -53,6 +80,21 @@ typedef struct arp_pkt
  */
 void arp_init();
 
+/**
+ * @brief 设置arp表容量，需在net_init()之前调用
+ * 
+ * @param n 最多的表项数
+ * @return int 成功为0，表已分配或n不合法时为-1
+ */
+int arp_set_max_entry(int n);
+
+/**
+ * @brief 获取arp表的统计计数
+ * 
+ * @return const arp_stats_t* 统计计数
+ */
+const arp_stats_t *arp_get_stats();
+
 /**
  * @brief 处理一个收到的数据包
  * 
@@ -60,6 +102,14 @@ void arp_init();
  */
 void arp_in(buf_t *buf);
 
+/**
+ * @brief 以向量方式处理一批收到的ARP数据包
+ * 
+ * @param bufs 去掉以太网头的数据包
+ * @param n 数据包个数
+ */
+void arp_in_vec(buf_t **bufs, int n);
+
 /**
  * @brief 处理一个要发送的数据包
  * 
@@ -69,6 +119,23 @@ void arp_in(buf_t *buf);
  */
 void arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol);
 
+/**
+ * @brief 使用邻居句柄发送一个IP数据包
+ *        句柄有效时直接写入表项中预先构造好的以太网头，否则查找arp表并更新句柄，找不到时与arp_out()相同
+ * 
+ * @param buf 要处理的数据包
+ * @param ip 目标ip地址
+ * @param neigh 邻居句柄
+ */
+void arp_out_neigh(buf_t *buf, uint8_t *ip, arp_neigh_t *neigh);
+
+/**
+ * @brief arp定时处理
+ * 
+ * @return int 距下一次需要定时处理的秒数，没有需要等待的事件时为-1
+ */
+int arp_timer();
+
 /**
  * @brief 更新arp表
  * 
@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #define DRIVER_IF_NAME "ens33" //使用的物理网卡名称
+#define DRIVER_BACKEND "pcap"  //默认的网卡驱动后端，可选pcap、tpacket、tap、xdp、file、loop，可写作"后端:网卡名"
 // #define DRIVER_IF_IP      \
 //     {                     \
 //         192, 168, 163, 103 \
@@ -18,14 +19,60 @@
     }                     //自定义网卡mac地址
 
 
+#define DRIVER_KERNEL_FILTER 1 //内核过滤程序只放行arp与发往本机ip的icmp、已打开端口的udp，为0时只按mac过滤
+
+#define DRIVER_TX_QUEUE_LEN 32     //发送队列长度，积攒到该数量时立即批量发送
+#define DRIVER_TX_SLOT_SIZE 2048   //发送队列中每个帧槽的大小，更大的帧直接发送
+#define DRIVER_TX_MAX_SEGS 8       //发送队列中每帧最多的段数，链式数据包除第一段外只引用不拷贝
+
+#define DRIVER_TAP_QUEUES 1 //TAP网卡的队列数，大于1时使用多队列TAP
+
+#define DRIVER_RX_CSUM_OFFLOAD 1 //接口的默认策略：采信TPACKET帧状态与TAP virtio-net头给出的校验和结论，已校验的数据包跳过软件校验
+
+#define DRIVER_LOOP_RING_SIZE 1024 //内存回环网卡环形队列的帧槽数，必须是2的幂
+#define DRIVER_LOOP_SLOT_SIZE 2048 //内存回环网卡帧槽大小
+
+#define DRIVER_XDP_FRAME_NR 4096   //AF_XDP UMEM中的帧数，一半用于接收一半用于发送
+#define DRIVER_XDP_FRAME_SIZE 2048 //AF_XDP UMEM帧大小，必须是2的幂
+#define DRIVER_XDP_RING_SIZE 2048  //AF_XDP各环形队列的描述符数，必须是2的幂
+#define DRIVER_XDP_QUEUE 0         //AF_XDP绑定的网卡接收队列
+#define DRIVER_XDP_ZERO_COPY 0     //为1时尝试驱动模式+零拷贝，网卡不支持时退回通用(SKB)模式+拷贝
+
+#define DRIVER_FILE_OUT_WINDOW (64 << 20) //文件后端输出文件的内存映射窗口大小，必须是页大小的整数倍
+
+#define DRIVER_TPACKET_BLOCK_SIZE (1 << 20) //TPACKET_V3环形缓冲区的块大小
+#define DRIVER_TPACKET_BLOCK_NR 64          //TPACKET_V3环形缓冲区的块数
+#define DRIVER_TPACKET_FRAME_SIZE 2048      //TPACKET_V3帧槽大小
+#define DRIVER_TPACKET_RETIRE_MS 1          //TPACKET_V3块未写满时的退役超时(毫秒)
+
+#define BUF_SMALL_SIZE 2048      //小缓冲区大小，以太网帧加上头部余量放得下即使用小缓冲区
+#define BUF_POOL_SMALL_NR 128    //缓冲池中小缓冲区的个数
+#define BUF_POOL_LARGE_NR 4      //缓冲池中大缓冲区（可装下最大udp包）的个数
+#define BUF_HEADROOM 64          //buf_init()保证数据前至少留出的头部余量，用于添加协议头，必须是8的倍数
+#define NET_CHECKSUM_SIMD 1      //x86上校验和按cpuid在运行时选用AVX-512/AVX2/SSE2实现，为0时只用标量实现
+#define NET_IP_ALIGN 2           //收到的以太网帧前留出的字节数，使以太网头之后的IP头4字节对齐
+
+#define NET_MEM_HUGEPAGE 2       //包内存区（缓冲池、发送队列、AF_XDP UMEM等）使用的大页大小(MB)：2或1024，0为普通页
+#define NET_MEM_SIZE (32 << 20)  //包内存区大小，按大页大小向上取整；用尽后的分配退回单独的普通页
+
 #define ETHERNET_MTU 1500 //以太网最大传输单元
+#define ETHERNET_BURST 32     //每次以太网轮询默认最多处理的数据包数，越小时延越低，越大吞吐越高
+#define ETHERNET_BURST_MAX 32 //每次以太网轮询最多处理的数据包数的上限
+#define ETHERNET_ZERO_COPY 1  //接收时数据包直接引用驱动的帧内存，不拷贝
+#define ETHERNET_EARLY_DEMUX 1 //发给本机、无选项、未分片的IPv4 UDP数据包由以太网层直接交给udp处理程序，为0时一律逐层处理
+#define ETHERNET_VECTOR 0      //为1时默认以向量方式处理一批数据包：整批依次经过以太网、IP、UDP各层，可由ethernet_set_vector()切换
+
+#define NET_IF_MAX 4           //最多的网络接口数
+#define NET_EVENT_LOOP 1       //主循环使用忙轮询+epoll的事件循环，为0时一直忙轮询
+#define NET_BUSY_POLL_US 200   //最近一次收到数据包后继续忙轮询的时间(微秒)，之后阻塞在epoll上
 
-#define ARP_MAX_ENTRY 16       //arp表最大长度
+#define ARP_MAX_ENTRY 1024     //arp表默认容量，可由arp_set_max_entry()在初始化前改变，表从包内存区分配
 #define ARP_TIMEOUT_SEC 60 * 5 //arp表过期时间
 #define ARP_MIN_INTERVAL 1     //向相同地址发送arp请求的最小间隔
 
 #define IP_DEFALUT_TTL 64 //IP默认TTL
 
 #define UDP_MAX_HANDLER 16 //最多的UDP处理程序数
+#define UDP_HASH_BITS 6    //按目的端口查找处理程序的哈希表有2^UDP_HASH_BITS个槽，不少于UDP_MAX_HANDLER的两倍
 
 #endif
\ No newline at end of file
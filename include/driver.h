@@ -1,7 +1,84 @@
 #ifndef DRIVER_H
 #define DRIVER_H
+#include <sys/uio.h>
+#include <net/if.h>
 #include "utils.h"
 
+typedef struct driver driver_t;
+struct sock_filter;
+
+#define DRIVER_NAME_LEN 256 //网卡名称的最大长度
+
+#define DRIVER_FILTER_MAX_INSNS (32 + UDP_MAX_HANDLER) //生成的经典BPF过滤程序的最大指令条数
+
+/**
+ * @brief 批量发送中的一帧，由若干段拼接而成
+ * 
+ */
+typedef struct driver_frame
+{
+    struct iovec *iov; //帧的各段
+    int iovcnt;        //段数
+    uint16_t len;      //帧的总长度
+} driver_frame_t;
+
+/**
+ * @brief 网卡驱动后端的操作表
+ *        每种后端（libpcap、TPACKET_V3等）实现一组open/recv/send/close，
+ *        由driver_select()在启动时选定
+ */
+typedef struct driver_ops
+{
+    const char *name;                          //后端名称
+    int (*open)(driver_t *drv);                //打开网卡，成功为0，失败为-1
+    int (*recv)(driver_t *drv, buf_t *buf);    //接收一个数据包，返回长度，未收到为0，错误为-1
+    int (*recv_batch)(driver_t *drv, buf_t *bufs, int n); //一次接收至多n个数据包，返回个数，错误为-1；可为NULL
+    int (*recv_zc)(driver_t *drv, buf_t *bufs, int n); //零拷贝接收，数据包指向驱动的可写帧内存，直到release；可为NULL
+    void (*release)(driver_t *drv);            //归还零拷贝接收的帧内存；可为NULL
+    int (*send)(driver_t *drv, buf_t *buf);    //发送一个数据包，成功为0，失败为-1
+    int (*send_batch)(driver_t *drv, driver_frame_t *frames, int n); //一次发送n个可能由多段组成的帧，返回成功发送的个数，错误为-1；可为NULL
+    void (*close)(driver_t *drv);              //关闭网卡
+    int (*fds)(driver_t *drv, int *fds, int max); //可供epoll等待的文件描述符，返回个数；可为NULL
+    int (*set_filter)(driver_t *drv);          //按drv中的mac、ip与udp端口重新生成内核过滤程序并原子替换；可为NULL
+} driver_ops_t;
+
+struct driver
+{
+    const driver_ops_t *ops;   //使用的后端
+    char if_name[DRIVER_NAME_LEN]; //网卡名称，file后端为文件名与选项
+    const uint8_t *mac;        //本网卡的mac地址，后端据此过滤收到的帧
+    const uint8_t *ip;         //本网卡的ip地址，用于内核过滤
+    uint16_t udp_ports[UDP_MAX_HANDLER]; //已打开的udp端口，用于内核过滤
+    int udp_port_nr;           //已打开的udp端口数
+    void *priv;                //后端私有数据
+    struct tx_slot *tx_queue;  //发送队列，第一次打开网卡时从包内存区分配
+    int tx_count;              //发送队列中积攒的帧数
+    uint8_t *xdp_umem;         //AF_XDP后端的UMEM，第一次打开时从包内存区分配，关闭后保留供再次打开使用
+    int opened;                //网卡是否已打开
+    int rx_csum_offload;       //为1时后端把内核或网卡已校验的数据包标记为BUF_CSUM_VALID，为0时一律由协议栈校验
+};
+
+extern const driver_ops_t driver_pcap_ops;    //libpcap后端
+extern const driver_ops_t driver_tpacket_ops; //AF_PACKET TPACKET_V3内存映射后端
+extern const driver_ops_t driver_tap_ops;     ///dev/net/tun TAP后端
+extern const driver_ops_t driver_xdp_ops;     //AF_XDP后端，帧收发都在UMEM中
+extern const driver_ops_t driver_file_ops;    //内存映射的pcap/pcapng文件回放与录制后端，用于离线处理
+extern const driver_ops_t driver_loop_ops;    //进程内内存回环后端，用于全协议栈吞吐测试
+
+/*
+ * 以下不带网卡参数的接口都作用于当前网卡（net_if_current的driver），
+ * 协议栈在轮询与发送时通过net_if_use()切换当前网卡
+ */
+
+/**
+ * @brief 按名称选择网卡驱动后端，需在driver_open()之前调用
+ * 
+ * @param name 后端名称，如"pcap"、"tpacket"，可写作"tap:tap0"同时指定网卡名称，
+ *             file后端写作"file:输入文件[,out=输出文件][,loop=次数]"
+ * @return int 成功为0，未知的后端为-1
+ */
+int driver_select(const char *name);
+
 /**
  * @brief 打开网卡
  * 
@@ -17,17 +94,110 @@ int driver_open();
  */
 int driver_recv(buf_t *buf);
 
+/**
+ * @brief 试图从网卡一次接收一批数据包
+ *        后端不支持批量接收时，退化为多次调用driver_recv()
+ * 
+ * @param bufs 存放收到的数据包的数组
+ * @param n 数组长度，即最多接收的数据包个数
+ * @return int 收到的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_batch(buf_t *bufs, int n);
+
+/**
+ * @brief 试图从网卡零拷贝接收一批数据包
+ *        收到的数据包只填写len、data与csum，data直接指向驱动的帧内存（环形缓冲区或UMEM中的帧，协议栈可以原地改写），
+ *        在调用driver_release()之前有效；需要保留数据包的协议层必须自行拷贝（如buf_copy()）。
+ *        后端不支持零拷贝时，退化为拷贝到bufs中的数据包
+ * 
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数，后端可能返回更少的数据包
+ * @return int 收到的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_zc(buf_t *bufs, int n);
+
+/**
+ * @brief 协议栈已处理完driver_recv_zc()收到的数据包，把帧内存还给驱动
+ * 
+ */
+void driver_release();
+
 /**
  * @brief 使用网卡发送一个数据包
+ *        数据包先拷贝进发送队列，在一次轮询结束、队列满或调用driver_flush()时批量发出。
+ *        链式数据包只拷贝第一段（协议头），其余各段只引用，在driver_flush()返回之前必须保持有效
  * 
- * @param buf 要发送的数据包
+ * @param buf 要发送的数据包，可以是链式数据包
  * @return int 成功为0，失败为-1
  */
 int driver_send(buf_t *buf);
 
+/**
+ * @brief 立即把发送队列中的数据包全部发出，供对时延敏感的发送者使用
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int driver_flush();
+
+/**
+ * @brief 获取网卡可供epoll等待的文件描述符，有数据包到来时可读
+ * 
+ * @param fds 存放文件描述符的数组
+ * @param max 数组长度
+ * @return int 文件描述符个数，后端不支持时为0
+ */
+int driver_fds(int *fds, int max);
+
 /**
  * @brief 关闭网卡
  * 
  */
 void driver_close();
-#endif
\ No newline at end of file
+
+/**
+ * @brief 更新当前网卡的内核过滤程序允许通过的udp端口，网卡已打开时立即重新生成并替换过滤程序
+ * 
+ * @param ports 已打开的udp端口
+ * @param n 端口数，不超过UDP_MAX_HANDLER
+ * @return int 成功为0，失败为-1
+ */
+int driver_set_filter(const uint16_t *ports, int n);
+
+/**
+ * @brief 由协议栈当前状态生成经典BPF过滤程序，供libpcap、AF_PACKET与TAP后端装入内核
+ * 
+ * @param drv 网卡，使用其中的mac、ip与已打开的udp端口
+ * @param prog 存放生成的程序
+ * @param max prog的长度，不小于DRIVER_FILTER_MAX_INSNS即可
+ * @return int 指令条数，prog放不下时为-1
+ */
+int driver_filter_build(const driver_t *drv, struct sock_filter *prog, int max);
+
+typedef void (*driver_loop_sink_t)(const uint8_t *frame, uint16_t len, void *arg);
+
+/**
+ * @brief 内存回环后端：由发生器线程调用，向协议栈注入一帧
+ * 
+ * @param frame 帧数据
+ * @param len 帧长度
+ * @return int 成功为0，接收队列满为-1
+ */
+int driver_loop_produce(const uint8_t *frame, uint16_t len);
+
+/**
+ * @brief 内存回环后端：由接收线程调用，取走协议栈发出的帧
+ * 
+ * @param sink 对每一帧调用的处理函数，可为NULL
+ * @param arg 传给处理函数的参数
+ * @param max 最多取走的帧数
+ * @return int 取走的帧数
+ */
+int driver_loop_consume(driver_loop_sink_t sink, void *arg, int max);
+
+/**
+ * @brief 内存回环后端：发送队列满而丢弃的帧数
+ * 
+ * @return uint64_t 丢弃的帧数
+ */
+uint64_t driver_loop_tx_drops();
+#endif
@@ -4,15 +4,19 @@
 #include "net.h"
 #include "utils.h"
 
-#pragma pack(1)
-
+/*
+ * 各协议头不使用pack(1)：字段都落在自然对齐的偏移上，没有填充（由静态断言保证），
+ * 编译器可以假定头部按字段自然对齐，用对齐的访存读取；
+ * 收到的帧前留出NET_IP_ALIGN字节，发送的数据从8字节对齐处开始，IP头因此总是4字节对齐
+ */
 typedef struct ether_hdr
 {
     uint8_t dest[NET_MAC_LEN]; // 目标mac地址
     uint8_t src[NET_MAC_LEN];  // 源mac地址
     uint16_t protocol;         // 协议/长度
 } ether_hdr_t;
-#pragma pack()
+_Static_assert(sizeof(ether_hdr_t) == 14, "ether_hdr_t must not be padded");
+_Static_assert((NET_IP_ALIGN + sizeof(ether_hdr_t)) % 4 == 0, "NET_IP_ALIGN must 4-byte align the header after ether_hdr_t");
 
 /**
  * @brief 初始化以太网协议
@@ -38,10 +42,43 @@ void ethernet_in(buf_t *buf);
 void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol);
 
 /**
- * @brief 一次以太网轮询
+ * @brief 用预先构造好的以太网头发送一个数据包，整个头一次拷贝，不再逐个字段填写
+ * 
+ * @param buf 要处理的数据包
+ * @param hdr 以太网头
+ */
+void ethernet_out_hdr(buf_t *buf, const ether_hdr_t *hdr);
+
+/**
+ * @brief 一次以太网轮询，按当前设置的突发大小批量收包处理
+ * 
+ * @return int 本次处理的数据包个数
+ */
+int ethernet_poll();
+
+/**
+ * @brief 一次以太网突发轮询
+ *        从网卡一次收至多burst个数据包，再逐个交给ethernet_in()处理，向量方式下整批按层处理
+ * 
+ * @param burst 最多处理的数据包个数，不超过ETHERNET_BURST_MAX
+ * @return int 本次处理的数据包个数
+ */
+int ethernet_poll_burst(int burst);
+
+/**
+ * @brief 设置每次以太网轮询最多处理的数据包数
+ * 
+ * @param burst 突发大小，取值范围为1到ETHERNET_BURST_MAX
+ */
+void ethernet_set_burst(int burst);
+
+/**
+ * @brief 设置是否以向量方式处理收到的数据包，默认为ETHERNET_VECTOR
+ *        向量方式下一批数据包整批依次经过以太网、IP、UDP各层，同一层内保持收包顺序
  * 
+ * @param on 为1时按层整批处理，为0时逐个处理
  */
-void ethernet_poll();
+void ethernet_set_vector(int on);
 
 static const uint8_t ether_broadcast_mac[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; //以太网广播mac地址
 #endif
\ No newline at end of file
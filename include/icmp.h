@@ -2,7 +2,6 @@
 #define ICMP_H
 #include <stdint.h>
 #include "utils.h"
-#pragma pack(1)
 typedef struct icmp_hdr
 {
     uint8_t type;      // 类型
@@ -11,8 +10,8 @@ typedef struct icmp_hdr
     uint16_t id;       // 标识符
     uint16_t seq;      // 序号
 } icmp_hdr_t;
+_Static_assert(sizeof(icmp_hdr_t) == 8, "icmp_hdr_t must not be padded");
 
-#pragma pack()
 typedef enum icmp_type
 {
     ICMP_TYPE_ECHO_REQUEST = 8, // 回显请求
@@ -3,7 +3,7 @@
 #include <stdint.h>
 #include "net.h"
 #include "utils.h"
-#pragma pack(1)
+#include "arp.h"
 typedef struct ip_hdr
 {
     uint8_t hdr_len : 4;         // 首部长, 4字节为单位
@@ -18,7 +18,7 @@ typedef struct ip_hdr
     uint8_t src_ip[NET_IP_LEN];  // 源IP
     uint8_t dest_ip[NET_IP_LEN]; // 目标IP
 } ip_hdr_t;
-#pragma pack()
+_Static_assert(sizeof(ip_hdr_t) == 20 && sizeof(ip_hdr_t) % 4 == 0, "ip_hdr_t must not be padded and keep the next header 4-byte aligned");
 
 #define IP_HDR_LEN_PER_BYTE (4)    //ip包头长度单位
 #define IP_HDR_OFFSET_PER_BYTE (8) //ip分片偏移长度单位
@@ -32,6 +32,24 @@ typedef struct ip_hdr
  */
 void ip_in(buf_t *buf);
 
+/**
+ * @brief 早期分用：发给本机、无选项、未分片的UDP数据包不经ip_in()与udp_in()逐层处理，
+ *        用一次哈希查找直接交给udp处理程序
+ * 
+ * @param buf 要处理的包，data指向IP头部
+ * @return int 已处理为1；不满足条件为0，此时buf不变，由调用者交给ip_in()
+ */
+int ip_early_demux(buf_t *buf);
+
+/**
+ * @brief 以向量方式处理一批收到的IP数据包
+ *        发给本机、无选项、未分片的UDP数据包整批交给udp_in_vec()，其余逐个交给ip_in()
+ * 
+ * @param bufs 去掉以太网头的数据包
+ * @param n 数据包个数，不超过ETHERNET_BURST_MAX
+ */
+void ip_in_vec(buf_t **bufs, int n);
+
 /**
  * @brief 处理一个要发送的ip数据包
  * 
@@ -40,4 +58,14 @@ void ip_in(buf_t *buf);
  * @param protocol 上层协议
  */
 void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol);
+
+/**
+ * @brief 使用邻居句柄发送一个ip数据包，供持续向同一地址发送的发送者使用
+ * 
+ * @param buf 要处理的包
+ * @param ip 目标ip地址
+ * @param protocol 上层协议
+ * @param neigh 邻居句柄，第一次使用前清零；为NULL时与ip_out()相同
+ */
+void ip_out_neigh(buf_t *buf, uint8_t *ip, net_protocol_t protocol, arp_neigh_t *neigh);
 #endif
\ No newline at end of file
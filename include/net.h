@@ -1,6 +1,7 @@
 #ifndef NET_H
 #define NET_H
 #include "config.h"
+#include "driver.h"
 #include <stdint.h>
 typedef enum net_protocol
 {
@@ -11,23 +12,138 @@ typedef enum net_protocol
     NET_PROTOCOL_TCP = 6,
 } net_protocol_t;
 
-static uint8_t net_if_mac[] = DRIVER_IF_MAC;
-static uint8_t net_if_ip[] = DRIVER_IF_IP;
-
 #define NET_MAC_LEN (6)                                     //mac地址长度
 #define NET_IP_LEN (4)                                      //ip地址长度
 #define swap16(x) ((((x)&0xFF) << 8) | (((x) >> 8) & 0xFF)) //为16位数据交换大小端
 
 /**
- * @brief 初始化协议栈
+ * @brief 接收校验和的统计计数，每个网络接口一组
+ * 
+ */
+typedef struct net_csum_stats
+{
+    uint64_t ip_verified;  //由协议栈计算IP头部校验和的数据包数，后端结论不涉及IP头部，每个都要校验
+    uint64_t ip_bad;       //IP头部校验和错误而丢弃的数据包数
+    uint64_t udp_trusted;  //采信后端结论、跳过UDP校验的数据报数
+    uint64_t udp_verified; //由协议栈计算UDP校验和的数据报数
+    uint64_t udp_bad;      //UDP校验和错误而丢弃的数据报数
+} net_csum_stats_t;
+
+/**
+ * @brief 早期分用的统计计数，每个网络接口一组，hits/(hits+misses)即快速路径的命中率；
+ *        向量处理另有一组同样含义的计数，两种方式的命中率互不干扰
+ * 
+ */
+typedef struct net_demux_stats
+{
+    uint64_t hits;   //经快速路径直接交给udp处理程序的IPv4数据包数
+    uint64_t misses; //不满足快速路径条件、退回逐层处理的IPv4数据包数
+} net_demux_stats_t;
+
+/**
+ * @brief 一个网络接口
+ *        每个接口有自己的驱动实例、mac地址、ip地址与mtu
+ * 
+ */
+typedef struct net_if
+{
+    uint8_t mac[NET_MAC_LEN]; //mac地址
+    uint8_t ip[NET_IP_LEN];   //ip地址
+    uint8_t mask[NET_IP_LEN]; //子网掩码
+    uint16_t mtu;             //最大传输单元
+    driver_t driver;          //驱动实例
+    net_csum_stats_t csum_stats; //接收校验和的统计计数
+    net_demux_stats_t demux_stats; //逐个处理时早期分用的统计计数
+    net_demux_stats_t vector_stats; //向量处理的统计计数，hits为经udp-input节点直接交给处理程序的数据包
+} net_if_t;
+
+extern net_if_t net_ifs[NET_IF_MAX]; //所有网络接口，net_ifs[0]为默认接口
+extern int net_if_count;             //网络接口个数
+extern net_if_t *net_if_current;     //当前网络接口，即正在收包或正在发包的接口
+
+#define net_if_mac (net_if_current->mac) //当前网络接口的mac地址
+#define net_if_ip (net_if_current->ip)   //当前网络接口的ip地址
+
+/**
+ * @brief 切换当前网络接口
+ * 
+ * @param nif 要切换到的网络接口
+ * @return net_if_t* 切换前的网络接口，用于恢复
+ */
+net_if_t *net_if_use(net_if_t *nif);
+
+/**
+ * @brief 设置网络接口是否采信后端给出的接收校验和结论，需在net_init()之前调用，默认为DRIVER_RX_CSUM_OFFLOAD
+ * 
+ * @param nif 网络接口
+ * @param on 为1时内核或网卡已校验的数据包跳过软件校验，为0时所有数据包都由协议栈校验
+ */
+void net_if_set_rx_csum(net_if_t *nif, int on);
+
+/**
+ * @brief 查找发往目的ip应使用的网络接口
+ * 
+ * @param ip 目的ip地址
+ * @return net_if_t* 目的ip所在子网的接口，都不在时为默认接口
+ */
+net_if_t *net_if_route(const uint8_t *ip);
+
+/**
+ * @brief 添加一个网络接口，需在net_init()之前调用
+ *        第一次添加时替换由config.h生成的默认接口
+ * 
+ * @param spec 接口描述，格式为"后端[:网卡名] ip[/前缀长度] mac [mtu]"，
+ *             如"tap:tap0 10.0.0.2/24 02:00:00:00:00:02 1500"
+ * @return int 成功为0，失败为-1
+ */
+int net_if_add(const char *spec);
+
+/**
+ * @brief 从配置文件添加网络接口，每行一个接口描述，#开头的行为注释
+ * 
+ * @param path 配置文件路径
+ * @return int 添加的接口个数，失败为-1
+ */
+int net_if_load(const char *path);
+
+/**
+ * @brief 事件循环的统计计数
+ * 
+ */
+typedef struct net_stats
+{
+    uint64_t polls;       //轮询次数
+    uint64_t empty_spins; //没有收到数据包的轮询次数
+    uint64_t wakeups;     //从epoll阻塞中被唤醒的次数
+    uint64_t timer_fires; //定时处理的次数
+} net_stats_t;
+
+/**
+ * @brief 初始化协议栈，依次打开所有网络接口
  * 
  */
 void net_init();
 
 /**
- * @brief 一次协议栈轮询
+ * @brief 一次协议栈轮询，依次轮询每个网络接口
+ * 
+ * @return int 本次处理的数据包个数
+ */
+int net_poll();
+
+/**
+ * @brief 协议栈事件循环，不返回
+ *        有流量时忙轮询，空闲超过NET_BUSY_POLL_US后阻塞在epoll上，
+ *        等待网卡的文件描述符可读或定时器(timerfd)到期
+ * 
+ */
+void net_loop();
+
+/**
+ * @brief 获取事件循环的统计计数
  * 
+ * @return const net_stats_t* 统计计数
  */
-void net_poll();
+const net_stats_t *net_get_stats();
 
 #endif
\ No newline at end of file
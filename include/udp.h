@@ -1,8 +1,9 @@
 #ifndef UDP_H
 #define UDP_H
 #include <stdint.h>
+#include <sys/uio.h>
 #include "utils.h"
-#pragma pack(1)
+#include "arp.h"
 typedef struct udp_hdr
 {
     uint16_t src_port;  // 源端口
@@ -10,6 +11,7 @@ typedef struct udp_hdr
     uint16_t total_len; // 整个数据包的长度
     uint16_t checksum;  // 校验和
 } udp_hdr_t;
+_Static_assert(sizeof(udp_hdr_t) == 8, "udp_hdr_t must not be padded");
 
 typedef struct udp_peso_hdr
 {
@@ -19,10 +21,10 @@ typedef struct udp_peso_hdr
     uint8_t protocol;    // 协议号
     uint16_t total_len;  // 整个数据包的长度
 } udp_peso_hdr_t;
-#pragma pack()
+_Static_assert(sizeof(udp_peso_hdr_t) == 12, "udp_peso_hdr_t must not be padded");
 
 typedef struct udp_entry udp_entry_t;
-typedef void (*udp_handler_t)(udp_entry_t *entry, uint8_t *src_ip, uint16_t src_port, buf_t *buf);
+typedef void (*udp_handler_t)(udp_entry_t *entry, uint8_t *src_ip, uint16_t src_port, buf_t *buf); //buf可能直接引用驱动的帧内存，处理程序返回后失效，需保留时自行拷贝
 struct udp_entry
 {
     int valid;             //有效位
@@ -30,6 +32,19 @@ struct udp_entry
     udp_handler_t handler; //处理程序
 };
 
+/**
+ * @brief 已连接的udp发送者，固定发往同一地址与端口
+ *        保存邻居句柄，发送时跳过arp表查找
+ * 
+ */
+typedef struct udp_conn
+{
+    uint16_t src_port;          //源端口号
+    uint16_t dest_port;         //目的端口号
+    uint8_t dest_ip[NET_IP_LEN]; //目的ip地址
+    arp_neigh_t neigh;          //邻居句柄
+} udp_conn_t;
+
 /**
  * @brief 初始化udp协议
  * 
@@ -44,6 +59,25 @@ void udp_init();
  */
 void udp_in(buf_t *buf, uint8_t *src_ip);
 
+/**
+ * @brief 早期分用的udp部分：数据报完整、端口已打开且校验和正确时去掉UDP头部，返回应交给的处理程序
+ *        不满足条件时不改动buf也不计数，由调用者退回逐层处理
+ * 
+ * @param buf 要处理的包，len为IP数据部分的长度
+ * @param src_ip 源ip地址
+ * @return udp_entry_t* 处理程序的表项，不满足条件为NULL
+ */
+udp_entry_t *udp_demux(buf_t *buf, uint8_t *src_ip);
+
+/**
+ * @brief 以向量方式处理一批收到的udp数据报，依次查找处理程序并调用
+ * 
+ * @param bufs 去掉IP头部的数据报，len为IP数据部分的长度
+ * @param src_ips 各数据报的源ip地址
+ * @param n 数据报个数，不超过ETHERNET_BURST_MAX
+ */
+void udp_in_vec(buf_t **bufs, uint8_t (*src_ips)[NET_IP_LEN], int n);
+
 /**
  * @brief 处理一个要发送的数据包
  * 
@@ -65,6 +99,57 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port
  */
 void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port);
 
+/**
+ * @brief 为要发送的udp包分配buffer，数据前留有以太网、IP与UDP头部的余量
+ *        应用直接把数据写进buf->data，再调用udp_send_buf()发送，省去udp_send()的一次拷贝
+ * 
+ * @param buf 分配到的buffer，data指向长为len的数据区
+ * @param len 数据长度
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int udp_alloc(buf_t *buf, uint16_t len);
+
+/**
+ * @brief 发送udp_alloc()分配并已写好数据的udp包，发送后释放buf
+ * 
+ * @param buf 要发送的包
+ * @param src_port 源端口号
+ * @param dest_ip 目的ip地址
+ * @param dest_port 目的端口号
+ */
+void udp_send_buf(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port);
+
+/**
+ * @brief 把调用者的若干段数据拼成一个udp包发送，各段只引用不拷贝
+ *        函数返回时数据已交给网卡，调用者随即可以改写或释放各段
+ * 
+ * @param iov 数据的各段，如应用层的首部与正文
+ * @param iovcnt 段数
+ * @param src_port 源端口号
+ * @param dest_ip 目的ip地址
+ * @param dest_port 目的端口号
+ * @return int 成功为0，数据过长或缓冲池用尽为-1
+ */
+int udp_sendv(const struct iovec *iov, int iovcnt, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port);
+
+/**
+ * @brief 初始化一个已连接的udp发送者
+ * 
+ * @param conn 发送者
+ * @param src_port 源端口号
+ * @param dest_ip 目的ip地址
+ * @param dest_port 目的端口号
+ */
+void udp_connect(udp_conn_t *conn, uint16_t src_port, const uint8_t *dest_ip, uint16_t dest_port);
+
+/**
+ * @brief 经已连接的发送者发送udp_alloc()分配并已写好数据的udp包，发送后释放buf
+ * 
+ * @param conn 发送者
+ * @param buf 要发送的包
+ */
+void udp_conn_send_buf(udp_conn_t *conn, buf_t *buf);
+
 /**
  * @brief 打开一个udp端口并注册处理程序
  * 
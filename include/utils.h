@@ -1,32 +1,145 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <stdint.h>
+#include <stddef.h>
 #include "config.h"
 #define BUF_MAX_LEN (UINT16_MAX + 14) //最大udp包 + 以太网帧报头长度
 
+_Static_assert(BUF_HEADROOM % 8 == 0 && NET_IP_ALIGN < 8, "buf_init() keeps data 8-byte aligned");
+#define BUF_LARGE_SIZE ((BUF_MAX_LEN + NET_IP_ALIGN + BUF_HEADROOM + 63) & ~63) //大缓冲区大小
+
+/**
+ * @brief 后端对收到的数据包给出的校验和结论
+ * 
+ */
+typedef enum buf_csum
+{
+    BUF_CSUM_NONE,  //没有结论，协议栈自行校验
+    BUF_CSUM_VALID, //内核或网卡已校验过传输层校验和，或是本机发出、校验和尚未填写的帧，协议栈不必再校验UDP；IP头部仍要校验
+} buf_csum_t;
+
+/**
+ * @brief 数据包
+ *        数据存放在缓冲池的缓冲区中，buf本身只有几个字段，可以放在栈上，但第一次buf_init()前必须清零（如buf_t buf = {0}），
+ *        用完后必须buf_free()；引用计数记在缓冲区头部，结构体赋值不增加引用，要共享缓冲区用buf_clone()；
+ *        零拷贝接收时data直接指向驱动的帧内存，与head无关；
+ *        分片与添加协议头时可以把头部放在自己的缓冲区中，用next引用另一段数据，避免拷贝负载
+ * 
+ */
 typedef struct buf
 {
     uint16_t len;                       // 包中有效数据大小
+    uint8_t csum;                       // 收到的数据包的校验和结论，见buf_csum_t；buf_init()时为BUF_CSUM_NONE
     uint8_t *data;                      // 包的数据起始地址
-    uint8_t payload[BUF_MAX_LEN];       // 最大负载数据量
+    uint8_t *head;                      // 从缓冲池取得的缓冲区，未取得时为NULL
+    struct buf *next;                   // 链式数据包的下一段，数据包由各段依次拼接而成；只有一段时为NULL
 } buf_t;
-static buf_t rxbuf, txbuf;          //一个buf足够单线程使用
+
+/**
+ * @brief 缓冲池的大小类别
+ * 
+ */
+typedef enum buf_class
+{
+    BUF_CLASS_SMALL, //BUF_SMALL_SIZE，用于一般的以太网帧
+    BUF_CLASS_LARGE, //BUF_LARGE_SIZE，只用于大的ip数据报
+    BUF_CLASS_NR,
+} buf_class_t;
+
+/**
+ * @brief 缓冲池的统计计数，每个大小类别一组
+ * 
+ */
+typedef struct buf_pool_stats
+{
+    uint32_t total;     //缓冲区总数
+    uint32_t in_use;    //正在使用的缓冲区数
+    uint32_t peak;      //同时使用的缓冲区数的峰值
+    uint64_t exhausted; //该类别用尽的次数，小缓冲区用尽时改用大缓冲区
+    uint64_t clones;    //buf_clone()共享缓冲区而没有拷贝的次数
+    uint64_t cow_copies; //写时复制的次数
+} buf_pool_stats_t;
 
 /**
  * @brief 初始化buffer为给定的长度，用于装载数据包
+ *        buf已持有同一大小类别的缓冲区时直接复用，否则归还原来的缓冲区并从缓冲池取一个，
+ *        数据放在缓冲区末尾，起始地址8字节对齐，前面至少留出BUF_HEADROOM的头部余量。
+ *        buf必须已清零或持有由buf_init()取得的缓冲区，不能是未初始化的局部变量
  * 
  * @param buf 要初始化的buffer
- * @param len 长度
+ * @param len 长度，不超过BUF_MAX_LEN
+ * @return int 成功为0，缓冲池用尽或长度过大为-1，此时buf的len为0、data为NULL
+ */
+int buf_init(buf_t *buf, int len); //buf可以在头部装卸数据，以供协议头的添加和去除
+
+/**
+ * @brief 初始化buffer用于装载网卡收到的以太网帧，与buf_init()相同，
+ *        只是帧前多留出NET_IP_ALIGN字节，使14字节的以太网头之后的IP头4字节对齐
+ * 
+ * @param buf 要初始化的buffer
+ * @param len 帧长度，不超过BUF_MAX_LEN
+ * @return int 成功为0，缓冲池用尽或长度过大为-1
+ */
+int buf_init_frame(buf_t *buf, int len);
+
+/**
+ * @brief 放弃buffer对缓冲区的引用，最后一个引用放弃时缓冲区回到缓冲池；不持有时什么也不做
+ * 
+ * @param buf 要释放的buffer
+ */
+void buf_free(buf_t *buf);
+
+/**
+ * @brief 让dst与src共享同一个缓冲区，只增加引用计数，不拷贝数据
+ *        之后任何一方要改写数据（包括添加协议头）都会先写时复制；
+ *        引用计数记在缓冲区头部，持有者个数没有上限；src是链式数据包或数据不在缓冲池中（如零拷贝接收）时退化为buf_copy()
+ * 
+ * @param dst 目的buffer，原来持有的缓冲区被放弃
+ * @param src 源buffer
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int buf_clone(buf_t *dst, buf_t *src);
+
+/**
+ * @brief 写时复制：buffer与别人共享缓冲区时，把数据拷贝到自己独占的新缓冲区，头部余量保持不变
+ *        独占缓冲区或数据不在缓冲池中时什么也不做，可以直接改写
+ * 
+ * @param buf 要改写的buffer
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int buf_make_writable(buf_t *buf);
+
+/**
+ * @brief 链式数据包的总长度
+ * 
+ * @param buf 数据包的第一段
+ * @return int 各段长度之和
+ */
+int buf_total_len(const buf_t *buf);
+
+/**
+ * @brief buffer在数据前还能添加的头部长度
+ * 
+ * @param buf buffer
+ * @return int 头部余量，数据不在自己的缓冲区中（零拷贝接收）时为0
+ */
+int buf_headroom(const buf_t *buf);
+
+/**
+ * @brief 获取缓冲池的统计计数
+ * 
+ * @return const buf_pool_stats_t* 按buf_class_t索引的BUF_CLASS_NR组计数
  */
-void buf_init(buf_t *buf, int len); //buf可以在头部装卸数据，以供协议头的添加和去除
+const buf_pool_stats_t *buf_pool_get_stats();
 
 /**
  * @brief 为buffer在头部增加一段长度，用于添加协议头
  * 
  * @param buf 要修改的buffer
  * @param len 增加的长度
+ * @return int 成功为0，与别人共享缓冲区而写时复制失败为-1
  */
-void buf_add_header(buf_t *buf, int len);
+int buf_add_header(buf_t *buf, int len);
 
 /**
  * @brief 为buffer在头部减少一段长度，去除协议头
@@ -37,12 +150,37 @@ void buf_add_header(buf_t *buf, int len);
 void buf_remove_header(buf_t *buf, int len);
 
 /**
- * @brief 复制一个buffer到新buffer
+ * @brief 复制一个buffer到新buffer，链式数据包拼接成连续的一段
  * 
  * @param dst 目的buffer
  * @param src 源buffer
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int buf_copy(buf_t *dst, buf_t *src);
+
+/**
+ * @brief 建立包内存区：一整块由大页支撑的内存，缓冲池、发送队列与环形队列都从中分配，减少TLB缺失
+ *        得不到NET_MEM_HUGEPAGE大小的大页时依次退回2MB大页与普通页；重复调用直接返回
+ * 
+ * @return int 使用大页为0，退回普通页为1，连普通页也分配不到为-1
+ */
+int net_mem_init();
+
+/**
+ * @brief 从包内存区分配一段清零的内存，不能释放，随进程存在
+ *        包内存区未建立时先建立；不小于一页的分配按页对齐，其余按缓存行对齐
+ * 
+ * @param size 大小
+ * @return void* 分配到的内存，失败为NULL
+ */
+void *net_mem_alloc(size_t size);
+
+/**
+ * @brief 包内存区使用的页面，用于启动时报告
+ * 
+ * @return const char* 如"2MB hugepages"
  */
-void buf_copy(buf_t *dst, buf_t *src);
+const char *net_mem_mode();
 
 /**
  * @brief 计算16位校验和
@@ -53,6 +191,70 @@ void buf_copy(buf_t *dst, buf_t *src);
  */
 uint16_t checksum16(uint16_t *buf, int len);
 
+/**
+ * @brief 计算一段数据的校验和部分和，多段数据的部分和依次传入即可合并，最后由checksum16_finish()得到校验和。
+ *        各段都按从偶数偏移开始计算，从奇数偏移开始的段要把它的部分和交换高低字节后再合并
+ * 
+ * @param buf 数据
+ * @param len 长度
+ * @param sum 之前的部分和，第一段为0
+ * @return uint32_t 新的部分和
+ */
+uint32_t checksum16_partial(const void *buf, size_t len, uint32_t sum);
+
+/**
+ * @brief 把数据拷贝到dst，同时计算部分和，比先拷贝再checksum16_partial()少读一遍数据
+ * 
+ * @param dst 目的地址，与src不能重叠
+ * @param src 数据
+ * @param len 长度
+ * @param sum 之前的部分和
+ * @return uint32_t 新的部分和
+ */
+uint32_t checksum16_copy(void *dst, const void *src, size_t len, uint32_t sum);
+
+/**
+ * @brief 把部分和折叠取反，得到网络字节序的校验和
+ * 
+ * @param sum 部分和，也可以是若干部分和与其他16、32位字（如伪头部各字段）直接相加的结果
+ * @return uint16_t 校验和
+ */
+uint16_t checksum16_finish(uint32_t sum);
+
+/**
+ * @brief 计算没有选项的20字节IPv4头部的校验和
+ * 
+ * @param hdr IPv4头部
+ * @return uint16_t 校验和
+ */
+uint16_t checksum16_ip_hdr(const void *hdr);
+
+/**
+ * @brief 按RFC 1624增量更新校验和：数据中的一个16位字由old_word变为new_word时，
+ *        HC' = ~(~HC + ~m + m')，不必重新扫描整个数据；各值都按内存中的原样（网络字节序）传入
+ * 
+ * @param check 原来的校验和
+ * @param old_word 改变前的16位字
+ * @param new_word 改变后的16位字
+ * @return uint16_t 新的校验和
+ */
+uint16_t checksum16_update16(uint16_t check, uint16_t old_word, uint16_t new_word);
+
+/**
+ * @brief 选择checksum16()的实现，默认在第一次计算时按cpuid选择最快的（AVX-512、AVX2、SSE2或标量）
+ * 
+ * @param name 实现的名称，"avx512"、"avx2"、"sse2"或"scalar"；为NULL时按cpuid选择
+ * @return int 成功为0，没有该实现或CPU不支持为-1
+ */
+int checksum16_use(const char *name);
+
+/**
+ * @brief 正在使用的校验和实现，用于报告
+ * 
+ * @return const char* 实现的名称
+ */
+const char *checksum16_impl();
+
 /**
  * @brief ip转字符串
  * 
@@ -19,10 +19,33 @@ static const arp_pkt_t arp_init_pkt = {
     .target_mac = {0}};
 
 /**
- * @brief arp地址转换表
+ * @brief arp表的哈希索引槽，以ip地址为键，开放定址、线性探测
  * 
  */
-arp_entry_t arp_table[ARP_MAX_ENTRY];
+typedef struct arp_slot
+{
+    uint32_t ip;    //表项的ip地址，按内存中的字节序直接取出
+    uint32_t entry; //表项在arp_table中的下标加1，0为空槽
+} arp_slot_t;
+
+/**
+ * @brief arp地址转换表，表项在其中的位置固定不变，邻居句柄直接指向表项
+ *        arp_init()第一次调用时按arp_set_max_entry()设置的容量从包内存区分配，此前为空
+ * 
+ */
+arp_entry_t *arp_table;
+int arp_table_size; //arp表容量，表未分配时为0
+
+static arp_slot_t arp_empty_index[2];            //表未分配时使用的空索引，查找总是未命中
+static arp_slot_t *arp_index = arp_empty_index;  //ip地址到表项的哈希索引，至多半满
+static uint32_t arp_index_mask = 1;              //索引槽数减1
+static int arp_index_shift = 31;                 //哈希值右移的位数，32减去索引槽数的位数
+static uint32_t *arp_free;                       //空闲表项的下标栈，栈顶为下标最小的表项
+static int arp_free_nr;                          //空闲表项数
+static int arp_hand;                             //CLOCK淘汰的指针
+static int arp_max_entry = ARP_MAX_ENTRY;        //arp_set_max_entry()设置的容量
+static time_t arp_now;                           //最近一次取得的时间，arp_update()与arp_timer()时刷新
+static arp_stats_t arp_stats;
 
 /**
  * @brief 长度为1的arp分组队列，当等待arp回复时暂存未发送的数据包
@@ -31,68 +54,216 @@ arp_entry_t arp_table[ARP_MAX_ENTRY];
 arp_buf_t arp_buf;
 
 /**
- * @brief 更新arp表
- *        你首先需要依次轮询检测ARP表中所有的ARP表项是否有超时，如果有超时，则将该表项的状态改为无效。
- *        接着，查看ARP表是否有无效的表项，如果有，则将arp_update()函数传递进来的新的IP、MAC信息插入到表中，
- *        并记录超时时间，更改表项的状态为有效。
- *        如果ARP表中没有无效的表项，则找到超时时间最长的一条表项，
- *        将arp_update()函数传递进来的新的IP、MAC信息替换该表项，并记录超时时间，设置表项的状态为有效。
+ * @brief 计算ip地址的哈希槽号
  * 
  * @param ip ip地址
- * @param mac mac地址
- * @param state 表项的状态
+ * @return uint32_t 槽号
  */
-void arp_update(uint8_t *ip, uint8_t *mac, arp_state_t state)
+static inline uint32_t arp_hash_slot(uint32_t ip)
 {
-    // TODO
-    for (int i = 0; i < ARP_MAX_ENTRY; i++)
+    return (uint32_t)(ip * 2654435761u) >> arp_index_shift;
+}
+
+/**
+ * @brief 把表项加入哈希索引
+ * 
+ * @param entry 表项，ip地址已填写
+ */
+static void arp_index_add(arp_entry_t *entry)
+{
+    uint32_t ip;
+    memcpy(&ip, entry->ip, NET_IP_LEN);
+    uint32_t slot = arp_hash_slot(ip);
+    while (arp_index[slot].entry)
+        slot = (slot + 1) & arp_index_mask;
+    arp_index[slot].ip = ip;
+    arp_index[slot].entry = entry - arp_table + 1;
+}
+
+/**
+ * @brief 把表项从哈希索引中删除
+ *        后面同一探测链上的槽依次前移填补空位，不留删除标记，查找的探测长度不随删除增长
+ * 
+ * @param entry 表项，必须在索引中
+ */
+static void arp_index_del(arp_entry_t *entry)
+{
+    uint32_t ip;
+    memcpy(&ip, entry->ip, NET_IP_LEN);
+    uint32_t hole = arp_hash_slot(ip);
+    while (arp_index[hole].entry != entry - arp_table + 1)
+        hole = (hole + 1) & arp_index_mask;
+    for (uint32_t slot = (hole + 1) & arp_index_mask; arp_index[slot].entry; slot = (slot + 1) & arp_index_mask)
     {
-        if(time(NULL)-arp_table[i].timeout >= ARP_TIMEOUT_SEC){
-            arp_table[i].state = ARP_INVALID; //ARP 表项是否有超时
+        uint32_t home = arp_hash_slot(arp_index[slot].ip);
+        if (((slot - home) & arp_index_mask) >= ((slot - hole) & arp_index_mask)) //本槽的理想位置不在空位之后，可以前移
+        {
+            arp_index[hole] = arp_index[slot];
+            hole = slot;
         }
-        
     }
-    int flag = 0;
-    for (int i = 0; i < ARP_MAX_ENTRY; i++)
+    arp_index[hole].entry = 0;
+}
+
+/**
+ * @brief 使表项失效并从索引中删除，表项的代次加1，指向它的邻居句柄随之失效
+ *        表项留在原位，不放回空闲栈，由调用者决定是重用还是归还
+ * 
+ * @param entry 有效的表项
+ */
+static void arp_entry_drop(arp_entry_t *entry)
+{
+    arp_index_del(entry);
+    entry->state = ARP_INVALID;
+    entry->gen++;
+}
+
+/**
+ * @brief 表项是否已超时
+ * 
+ * @param entry 表项
+ * @return int 超时为1
+ */
+static inline int arp_entry_expired(arp_entry_t *entry)
+{
+    return arp_now - entry->timeout >= ARP_TIMEOUT_SEC;
+}
+
+/**
+ * @brief 取得一个空闲表项
+ *        有空闲表项时取下标最小的一个；表满时按CLOCK算法转动指针，
+ *        淘汰遇到的第一个已超时或自上次经过以来未被查找过的表项，被查找过的清除其访问位后跳过，至多转两圈
+ * 
+ * @return arp_entry_t* 已不在索引中的表项
+ */
+static arp_entry_t *arp_entry_alloc()
+{
+    if (arp_free_nr)
+        return &arp_table[arp_free[--arp_free_nr]];
+    while (1)
     {
-        if (arp_table[i].state== ARP_INVALID) //查找 ARP 表项是否有 ARP_INVALID
+        arp_entry_t *entry = &arp_table[arp_hand];
+        if (++arp_hand == arp_table_size)
+            arp_hand = 0;
+        if (arp_entry_expired(entry))
+            arp_stats.expired++;
+        else if (!entry->referenced)
+            arp_stats.evictions++;
+        else
         {
-            //新的 ip、mac 信息插入到表中，记录超时时间，更改 state 状态
-            memcpy(arp_table[i].ip,ip,sizeof(arp_table[i].ip));
-            memcpy(arp_table[i].mac,mac,sizeof(arp_table[i].mac));
-            arp_table[i].timeout = time(NULL);
-            arp_table[i].state = ARP_VALID;
-            flag = 1;
-            break;
+            entry->referenced = 0;
+            continue;
         }
+        arp_entry_drop(entry);
+        return entry;
     }
-    if (flag == 0) // 如果 ARP 表中所有的表项都不是 ARP_INVALID
+}
+
+/**
+ * @brief 填写表项的ip与mac地址，并为当前网络接口预先构造发往该邻居的以太网头
+ *        表项的代次加1，指向它的邻居句柄随之失效
+ * 
+ * @param entry 表项
+ * @param ip ip地址
+ * @param mac mac地址
+ */
+static void arp_entry_set(arp_entry_t *entry, uint8_t *ip, uint8_t *mac)
+{
+    memcpy(entry->ip, ip, NET_IP_LEN);
+    memcpy(entry->mac, mac, NET_MAC_LEN);
+    entry->nif = net_if_current;
+    memcpy(entry->hdr.dest, mac, NET_MAC_LEN);
+    memcpy(entry->hdr.src, net_if_mac, NET_MAC_LEN);
+    entry->hdr.protocol = swap16(NET_PROTOCOL_IP);
+    entry->gen++;
+}
+
+/**
+ * @brief 在哈希索引中查找ip地址对应的表项，不检查超时
+ * 
+ * @param ip ip地址
+ * @return arp_entry_t* 表项，未找到时为NULL
+ */
+static inline arp_entry_t *arp_find(uint8_t *ip)
+{
+    uint32_t key;
+    memcpy(&key, ip, NET_IP_LEN);
+    for (uint32_t slot = arp_hash_slot(key); arp_index[slot].entry; slot = (slot + 1) & arp_index_mask)
+        if (arp_index[slot].ip == key)
+            return &arp_table[arp_index[slot].entry - 1];
+    return NULL;
+}
+
+/**
+ * @brief 更新arp表
+ *        已有该ip地址的表项时原地刷新超时时间，mac地址或网络接口变化时重新构造以太网头；
+ *        否则取一个空闲表项插入，表满时按CLOCK算法淘汰一个表项。
+ *        超时的表项在查找或淘汰时才发现并删除，不再每次扫描整张表
+ * 
+ * @param ip ip地址
+ * @param mac mac地址
+ * @param state 表项的状态
+ */
+void arp_update(uint8_t *ip, uint8_t *mac, arp_state_t state)
+{
+    if (arp_table_size == 0) //表分配失败
+        return;
+    arp_now = time(NULL);
+    arp_entry_t *entry = arp_find(ip);
+    if (entry == NULL)
     {
-        int to_be_del = 0;
-        for (int i = 1; i < ARP_MAX_ENTRY; i++) //找到超时时间最长的一条表项
-        {
-            if(time(NULL)-arp_table[i].timeout > time(NULL)-arp_table[i-1].timeout)
-                to_be_del = i;
-        }
-        memcpy(arp_table[to_be_del].ip,ip,sizeof(arp_table[to_be_del].ip));
-        memcpy(arp_table[to_be_del].mac,mac,sizeof(arp_table[to_be_del].mac));
-        arp_table[to_be_del].timeout = time(NULL);
-        
+        entry = arp_entry_alloc();
+        entry->referenced = 0;
+        arp_entry_set(entry, ip, mac);
+        arp_index_add(entry);
     }
+    else if (memcmp(entry->mac, mac, NET_MAC_LEN) != 0 || entry->nif != net_if_current)
+        arp_entry_set(entry, ip, mac);
+    entry->timeout = arp_now;
+    entry->state = ARP_VALID;
 }
 
 /**
- * @brief 从arp表中根据ip地址查找mac地址
+ * @brief 从arp表中根据ip地址查找表项
+ *        找到的表项已超时时删除并视为未找到，否则置访问位，使其在CLOCK淘汰中多留一圈
  * 
  * @param ip 欲转换的ip地址
- * @return uint8_t* mac地址，未找到时为NULL
+ * @return arp_entry_t* 有效的表项，未找到时为NULL
  */
-static uint8_t *arp_lookup(uint8_t *ip)
+static arp_entry_t *arp_lookup(uint8_t *ip)
 {
-    for (int i = 0; i < ARP_MAX_ENTRY; i++)
-        if (arp_table[i].state == ARP_VALID && memcmp(arp_table[i].ip, ip, NET_IP_LEN) == 0)
-            return arp_table[i].mac;
-    return NULL;
+    arp_entry_t *entry = arp_find(ip);
+    if (entry != NULL && arp_entry_expired(entry))
+    {
+        arp_entry_drop(entry);
+        arp_free[arp_free_nr++] = entry - arp_table;
+        arp_stats.expired++;
+        entry = NULL;
+    }
+    if (entry == NULL)
+    {
+        arp_stats.misses++;
+        return NULL;
+    }
+    entry->referenced = 1;
+    arp_stats.hits++;
+    return entry;
+}
+
+/**
+ * @brief 把数据包发给已解析的邻居
+ *        从学到表项的网络接口发送IP数据包时直接使用预先构造好的以太网头
+ * 
+ * @param entry 表项
+ * @param buf 要发送的数据包
+ * @param protocol 上层协议
+ */
+static void arp_entry_out(arp_entry_t *entry, buf_t *buf, net_protocol_t protocol)
+{
+    if (protocol == NET_PROTOCOL_IP && entry->nif == net_if_current)
+        ethernet_out_hdr(buf, &entry->hdr);
+    else
+        ethernet_out(buf, entry->mac, protocol);
 }
 
 /**
@@ -111,8 +282,9 @@ uint8_t blk_mac[6] = {0x00,0x00,0x00,0x00,0x00,0x00};
 static void arp_req(uint8_t *target_ip)
 {
     // TODO
-    buf_t txbuf;
-    buf_init(&txbuf,sizeof(arp_pkt_t));
+    buf_t txbuf = {0};
+    if (buf_init(&txbuf,sizeof(arp_pkt_t)) < 0)
+        return;
     arp_pkt_t *arp_head = (arp_pkt_t *)txbuf.data;
     //硬件类型
     memcpy(arp_head->sender_ip,net_if_ip,sizeof(net_if_ip));
@@ -131,6 +303,7 @@ static void arp_req(uint8_t *target_ip)
     // ARP 操作类型为 ARP_REQUEST
     // 调用 ethernet_out 函数将 ARP 报文发送出去
     ethernet_out(&txbuf, ether_broadcast_mac, NET_PROTOCOL_ARP);
+    buf_free(&txbuf);
 }
 
 /**
@@ -172,14 +345,15 @@ void arp_in(buf_t *buf)
     if (arp_buf.valid == ARP_VALID)
     {
         
-        uint8_t *mac_from_table = arp_lookup(arp_buf.ip); //根据 IP 地址来查找 ARP 表 (arp_table)
+        arp_entry_t *entry = arp_lookup(arp_buf.ip); //根据 IP 地址来查找 ARP 表 (arp_table)
         //如果能找到该 IP
         //地址对应的 MAC 地址，则将缓存的数据包 arp_buf 再发送给以太网层，即调
         //用 ethernet_out 函数直接发出去。
-        if (mac_from_table != NULL)
+        if (entry != NULL)
         {
-            ethernet_out(&arp_buf.buf,mac_from_table,arp_buf.protocol);
+            arp_entry_out(entry,&arp_buf.buf,arp_buf.protocol);
             arp_buf.valid = 0;
+            buf_free(&arp_buf.buf);
         }
     }
     else
@@ -191,8 +365,9 @@ void arp_in(buf_t *buf)
             arp->target_ip[3] == net_if_ip[3] ) //回应一个响应报文
         {
             
-            buf_t req_buf;
-            buf_init(&req_buf,28); //seg fault!
+            buf_t req_buf = {0};
+            if (buf_init(&req_buf,28) < 0)
+                return;
             arp_pkt_t *arp_head = (arp_pkt_t *)req_buf.data;
             memcpy(arp_head->sender_ip,net_if_ip,sizeof(net_if_ip));
             memcpy(arp_head->target_ip,arp->sender_ip,sizeof(net_if_ip));
@@ -208,11 +383,25 @@ void arp_in(buf_t *buf)
             //操作类型：占2字节，指定本次 ARP 报文类型。1标识 ARP 请求报文，2标识 ARP应答报文。
             arp_head->opcode = swap16(ARP_REPLY);
             ethernet_out(&req_buf,arp->sender_mac,NET_PROTOCOL_ARP);
+            buf_free(&req_buf);
         }
         
     }
 }
 
+/**
+ * @brief 以向量方式处理一批收到的ARP数据包（arp-input节点）
+ *        ARP报文很少且每个都可能改动arp表，按收包顺序逐个交给arp_in()
+ * 
+ * @param bufs 去掉以太网头的数据包
+ * @param n 数据包个数
+ */
+void arp_in_vec(buf_t **bufs, int n)
+{
+    for (int i = 0; i < n; i++)
+        arp_in(bufs[i]);
+}
+
 /**
  * @brief 处理一个要发送的数据包
  *        你需要根据IP地址来查找ARP表
@@ -227,33 +416,148 @@ void arp_in(buf_t *buf)
 void arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
 {
     // TODO
-    uint8_t *mac_from_table = arp_lookup(ip); //根据 IP 地址来查找 ARP 表 (arp_table)
-    // 如果能找到该 IP 地址对应的 MAC 地址，则将数据包直接发送给以太网层，即
-    //调用 ethernet_out 函数直接发出去。
-    if (mac_from_table != NULL)
+    arp_entry_t *entry = arp_lookup(ip); //根据 IP 地址来查找 ARP 表 (arp_table)
+    // 如果能找到该 IP 地址对应的 MAC 地址，则将数据包直接发送给以太网层，
+    // IP数据包使用表项中预先构造好的以太网头
+    if (entry != NULL)
     {
-        ethernet_out(buf, mac_from_table, protocol);
+        arp_entry_out(entry, buf, protocol);
     }
     //如果没有找到对应的 MAC 地址，则调用 arp_req 函数，发一个 ARP request
     //报文。
     else
     {
-        buf_copy(&arp_buf.buf,buf);
+        if (buf_clone(&arp_buf.buf,buf) < 0) //缓冲池用尽，丢弃
+            return;
         arp_buf.valid = 1;
         memcpy(arp_buf.ip,ip,sizeof(ip));
         memcpy(&arp_buf.protocol,&protocol,sizeof(protocol));
+        arp_buf.req_time = time(NULL);
         arp_req(ip);
     }
 }
 
+/**
+ * @brief 使用邻居句柄发送一个IP数据包
+ *        句柄指向的表项未被改写、仍然有效、未超时且属于当前网络接口时，不查找arp表，置访问位后直接写入预先构造好的以太网头；
+ *        否则查找arp表并更新句柄，找不到时与arp_out()相同，缓存数据包并发送arp请求
+ * 
+ * @param buf 要处理的数据包
+ * @param ip 目标ip地址
+ * @param neigh 邻居句柄
+ */
+void arp_out_neigh(buf_t *buf, uint8_t *ip, arp_neigh_t *neigh)
+{
+    arp_entry_t *entry = neigh->entry;
+    if (entry && entry->gen == neigh->gen && entry->state == ARP_VALID && entry->nif == net_if_current &&
+        !arp_entry_expired(entry)) //超时的表项交给arp_lookup()删除并重新解析
+    {
+        entry->referenced = 1; //经句柄发送也算使用，CLOCK淘汰时同样跳过一次
+        ethernet_out_hdr(buf, &entry->hdr);
+        return;
+    }
+    if ((entry = arp_lookup(ip)) == NULL)
+    {
+        arp_out(buf, ip, NET_PROTOCOL_IP);
+        return;
+    }
+    neigh->entry = entry;
+    neigh->gen = entry->gen;
+    arp_entry_out(entry, buf, NET_PROTOCOL_IP);
+}
+
+/**
+ * @brief arp定时处理
+ *        arp_buf中有等待响应的数据包，且距上次发送arp请求已超过ARP_MIN_INTERVAL时，重发arp请求
+ * 
+ * @return int 距下一次需要定时处理的秒数，没有等待响应的数据包时为-1
+ */
+int arp_timer()
+{
+    if (!arp_buf.valid)
+        return -1;
+    time_t now = arp_now = time(NULL);
+    if (now - arp_buf.req_time >= ARP_MIN_INTERVAL)
+    {
+        arp_buf.req_time = now;
+        net_if_t *prev_if = net_if_use(net_if_route(arp_buf.ip));
+        arp_req(arp_buf.ip);
+        net_if_use(prev_if);
+    }
+    return ARP_MIN_INTERVAL - (now - arp_buf.req_time);
+}
+
+/**
+ * @brief 设置arp表容量，需在net_init()之前调用
+ *        表在arp_init()时从包内存区分配，不能释放，用于需要解析大量邻居的场合
+ * 
+ * @param n 最多的表项数
+ * @return int 成功为0，表已分配或n不合法时为-1，此时容量不变
+ */
+int arp_set_max_entry(int n)
+{
+    if (arp_table != NULL || n < 1 || n > (1 << 28))
+        return -1;
+    arp_max_entry = n;
+    return 0;
+}
+
+/**
+ * @brief 从包内存区分配arp表、索引与空闲栈，与缓冲池一样由大页支撑，大表查找时少些TLB缺失
+ * 
+ * @return int 成功为0，失败为-1
+ */
+static int arp_table_alloc()
+{
+    int bits = 1;
+    while ((1 << bits) < 2 * arp_max_entry)
+        bits++;
+    arp_entry_t *table = net_mem_alloc((size_t)arp_max_entry * sizeof(arp_entry_t));
+    arp_slot_t *index = net_mem_alloc(((size_t)1 << bits) * sizeof(arp_slot_t));
+    uint32_t *free_list = net_mem_alloc((size_t)arp_max_entry * sizeof(uint32_t));
+    if (table == NULL || index == NULL || free_list == NULL)
+        return -1;
+    arp_table = table;
+    arp_index = index;
+    arp_index_mask = (1u << bits) - 1;
+    arp_index_shift = 32 - bits;
+    arp_free = free_list;
+    arp_table_size = arp_max_entry;
+    return 0;
+}
+
+/**
+ * @brief 获取arp表的统计计数
+ * 
+ * @return const arp_stats_t* 统计计数
+ */
+const arp_stats_t *arp_get_stats()
+{
+    return &arp_stats;
+}
+
 /**
  * @brief 初始化arp协议
+ *        第一次调用时分配arp表，之后每次清空arp表与索引，空闲栈按下标从小到大弹出
  * 
  */
 void arp_init()
 {
-    for (int i = 0; i < ARP_MAX_ENTRY; i++)
+    if (arp_table == NULL && arp_table_alloc() < 0)
+        fprintf(stderr, "Error: failed to allocate the arp table (%d entries)\n", arp_max_entry);
+    if (arp_table != NULL)
+        memset(arp_index, 0, (arp_index_mask + 1) * sizeof(arp_slot_t));
+    for (int i = 0; i < arp_table_size; i++)
+    {
+        if (arp_table[i].state != ARP_INVALID)
+            arp_table[i].gen++; //邻居句柄失效
         arp_table[i].state = ARP_INVALID;
+        arp_table[i].referenced = 0;
+        arp_free[i] = arp_table_size - 1 - i;
+    }
+    arp_free_nr = arp_table_size;
+    arp_hand = 0;
+    arp_now = time(NULL);
     arp_buf.valid = 0;
     arp_req(net_if_ip);
-}
\ No newline at end of file
+}
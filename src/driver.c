@@ -1,74 +1,135 @@
+#define _GNU_SOURCE //sendmmsg()
 #include <pcap.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
 #include "utils.h"
 #include "config.h"
 #include "driver.h"
+#include "net.h"
 
-static pcap_t *pcap;
 static char pcap_errbuf[PCAP_ERRBUF_SIZE];
 
-# define PCAP_BUF_SIZE (65535)
+/**
+ * @brief 可供选择的网卡驱动后端
+ * 
+ */
+static const driver_ops_t *driver_backends[] = {
+    &driver_pcap_ops,
+    &driver_tpacket_ops,
+    &driver_tap_ops,
+    &driver_xdp_ops,
+    &driver_file_ops,
+    &driver_loop_ops,
+};
 
 /**
- * @brief 打开网卡
+ * @brief 发送队列中的一个帧槽
  * 
- * @return int 成功为0，失败为-1
  */
-int driver_open()
+typedef struct tx_slot
 {
-    uint32_t net, mask;
+    uint16_t len;                           //帧的总长度
+    int iovcnt;                             //帧的段数
+    struct iovec iov[DRIVER_TX_MAX_SEGS];   //帧的各段，第一段指向data，其余引用链式数据包的数据
+    uint8_t data[DRIVER_TX_SLOT_SIZE];      //拷贝进来的第一段
+} tx_slot_t;
 
-    // 根据DRIVER_IF_NAME网卡名，获取网卡的网络号net和子网掩码mask
-    if (pcap_lookupnet(DRIVER_IF_NAME, &net, &mask, pcap_errbuf) == -1) //查找网卡
+/**
+ * @brief libpcap后端的私有数据
+ *        libpcap只能逐帧pcap_sendpacket()，发送另用一个绑定到同一网卡的AF_PACKET套接字，
+ *        以sendmmsg()一次系统调用发出整个发送队列，多段的帧由内核拼接
+ * 
+ */
+typedef struct pcap_priv
+{
+    pcap_t *pcap; //libpcap句柄，用于接收
+    int tx_fd;    //发送用的AF_PACKET套接字，打不开（如网卡不是Linux网络接口）时为-1，退回pcap_sendpacket()
+} pcap_priv_t;
+
+static int driver_send_frame(driver_t *drv, driver_frame_t *frame);
+
+/**
+ * @brief 打开发送用的AF_PACKET套接字并绑定到网卡
+ *        协议号为0，内核不会把收到的帧复制给这个套接字
+ * 
+ * @param if_name 网卡名称
+ * @return int 套接字，失败为-1
+ */
+static int pcap_tx_socket_open(const char *if_name)
+{
+    int fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_ifindex = if_nametoindex(if_name);
+    if (sll.sll_ifindex == 0 || bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
     {
-        fprintf(stderr, "Error in pcap_lookupnet: %s\n", pcap_geterr(pcap));
+        close(fd);
         return -1;
     }
+    return fd;
+}
+
+/**
+ * @brief 以libpcap打开网卡
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int pcap_driver_open(driver_t *drv)
+{
+    pcap_priv_t *priv = calloc(1, sizeof(pcap_priv_t));
+    pcap_t *pcap;
+    if (priv == NULL)
+        return -1;
+    priv->tx_fd = -1;
+    drv->priv = priv;
 
     // 获取一个数据包捕获的描述符，以便用来查看网络上的数据包。
     // 第二个参数表示捕获的最大字节数，通常来说数据包的大小不会超过65535
     // 第三个参数表示开启混杂模式，0表示非混杂模式，任何其他值表示混合模式
     // 第四个参数指定需要等待的毫秒数，0表示一直等待直到有数据包到来
-    if ((pcap = pcap_open_live(DRIVER_IF_NAME, 65536, 1, 0, pcap_errbuf)) == NULL) //混杂模式打开网卡
+    if ((pcap = pcap_open_live(drv->if_name, 65536, 1, 0, pcap_errbuf)) == NULL) //混杂模式打开网卡
     {
-        fprintf(stderr, "Error in pcap_open_live: %s.\n", pcap_geterr(pcap));
-        return -1;
+        fprintf(stderr, "Error in pcap_open_live: %s.\n", pcap_errbuf);
+        goto fail;
     }
+    priv->pcap = pcap;
     if (pcap_setnonblock(pcap, 1, pcap_errbuf) != 0) //设置非阻塞模式
     {
         fprintf(stderr, "Error in pcap_setnonblock: %s\n", pcap_geterr(pcap));
-        return -1;
-    }
-    char filter_exp[PCAP_BUF_SIZE];
-    struct bpf_program fp;
-    uint8_t mac_addr[6] = DRIVER_IF_MAC;
-    sprintf(filter_exp, //过滤数据包
-            "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
-            mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
-            mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-    
-    // 只捕获发往本网卡接口与广播的数据帧，也就是只处理发往这张网卡的数据包
-    if (pcap_compile(pcap, &fp, filter_exp, 0, net) == -1)
-    {
-        fprintf(stderr, "Error in pcap_compile: %s\n", pcap_geterr(pcap));
-        return -1;
-    }
-    if (pcap_setfilter(pcap, &fp) == -1)
-    {
-        fprintf(stderr, "Error in pcap_setfilter: %s\n", pcap_geterr(pcap));
-        return -1;
+        goto fail;
     }
+    if ((priv->tx_fd = pcap_tx_socket_open(drv->if_name)) < 0)
+        fprintf(stderr, "Warning: no AF_PACKET socket on %s (%s), sending frame by frame\n", drv->if_name, strerror(errno));
+    // 只捕获发往本网卡接口与广播的数据帧，过滤程序由driver_open()调用pcap_driver_set_filter()装入
     return 0;
+
+fail:
+    if (priv->pcap)
+        pcap_close(priv->pcap);
+    free(priv);
+    drv->priv = NULL;
+    return -1;
 }
 
 /**
- * @brief 试图从网卡接收数据包
+ * @brief 以libpcap从网卡接收数据包
  * 
+ * @param drv 网卡
  * @param buf 收到的数据包
  * @return int 数据包的长度，未收到为0，错误为-1
  */
-int driver_recv(buf_t *buf)
+static int pcap_driver_recv(driver_t *drv, buf_t *buf)
 {
+    pcap_t *pcap = ((pcap_priv_t *)drv->priv)->pcap;
     struct pcap_pkthdr *pkt_hdr;
     const uint8_t *pkt_data;
 
@@ -78,22 +139,64 @@ int driver_recv(buf_t *buf)
         return 0;
     else if (ret == 1)
     {
-        memcpy(buf->data, pkt_data, pkt_hdr->len);
-        buf->len = pkt_hdr->len;
-        return pkt_hdr->len;
+        if (buf_init_frame(buf, pkt_hdr->caplen) < 0) //缓冲池用尽，丢弃
+            return 0;
+        memcpy(buf->data, pkt_data, pkt_hdr->caplen);
+        return pkt_hdr->caplen;
     }
     fprintf(stderr, "Error in driver_recv: %s\n", pcap_geterr(pcap));
     return -1;
 }
 
 /**
- * @brief 使用网卡发送一个数据包
+ * @brief pcap_dispatch()的回调，把一个数据包拷贝到批量接收数组的下一个位置
  * 
+ * @param user 批量接收的游标
+ * @param pkt_hdr 数据包信息
+ * @param pkt_data 数据包内容
+ */
+static void pcap_batch_handler(u_char *user, const struct pcap_pkthdr *pkt_hdr, const u_char *pkt_data)
+{
+    buf_t **next = (buf_t **)user;
+    if (buf_init_frame(*next, pkt_hdr->caplen) < 0) //缓冲池用尽，丢弃
+        return;
+    memcpy((*next)->data, pkt_data, pkt_hdr->caplen);
+    (*next)++;
+}
+
+/**
+ * @brief 以libpcap一次接收一批数据包，一次pcap_dispatch()处理内核缓冲区中至多n个数据包
+ *        libpcap交出的数据是只读的，协议栈又会原地改写收到的帧（如回显应答），所以不提供零拷贝接收，
+ *        driver_recv_zc()退化为本函数，拷贝到缓冲池中
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数，错误为-1
+ */
+static int pcap_driver_recv_batch(driver_t *drv, buf_t *bufs, int n)
+{
+    pcap_t *pcap = ((pcap_priv_t *)drv->priv)->pcap;
+    buf_t *next = bufs;
+    if (pcap_dispatch(pcap, n, pcap_batch_handler, (u_char *)&next) < 0)
+    {
+        fprintf(stderr, "Error in driver_recv_batch: %s\n", pcap_geterr(pcap));
+        return -1;
+    }
+    return next - bufs;
+}
+
+/**
+ * @brief 以libpcap发送一个数据包
+ * 
+ * @param drv 网卡
  * @param buf 要发送的数据包
  * @return int 成功为0，失败为-1
  */
-int driver_send(buf_t *buf)
+static int pcap_driver_send(driver_t *drv, buf_t *buf)
 {
+    pcap_t *pcap = ((pcap_priv_t *)drv->priv)->pcap;
+
     // 将数据包发往指定的网卡接口
     if (pcap_sendpacket(pcap, buf->data, buf->len) == -1)
     {
@@ -104,11 +207,383 @@ int driver_send(buf_t *buf)
     return 0;
 }
 
+/**
+ * @brief 通过AF_PACKET套接字的sendmmsg()一次系统调用发送一批帧
+ *        没有AF_PACKET套接字时逐帧pcap_sendpacket()
+ * 
+ * @param drv 网卡
+ * @param frames 要发送的帧，各段由内核拼接
+ * @param n 帧的个数
+ * @return int 成功发送的帧数，错误为-1
+ */
+static int pcap_driver_send_batch(driver_t *drv, driver_frame_t *frames, int n)
+{
+    pcap_priv_t *priv = drv->priv;
+    if (priv->tx_fd < 0)
+    {
+        int sent = 0;
+        for (int i = 0; i < n; i++)
+            if (driver_send_frame(drv, &frames[i]) == 0)
+                sent++;
+        return sent;
+    }
+
+    struct mmsghdr msgs[n];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < n; i++)
+    {
+        msgs[i].msg_hdr.msg_iov = frames[i].iov;
+        msgs[i].msg_hdr.msg_iovlen = frames[i].iovcnt;
+    }
+
+    int sent = 0;
+    while (sent < n)
+    {
+        int ret = sendmmsg(priv->tx_fd, msgs + sent, n - sent, 0);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Error in driver_send_batch: %s\n", strerror(errno));
+            return sent ? sent : -1;
+        }
+        sent += ret;
+    }
+    return sent;
+}
+
+/**
+ * @brief 关闭libpcap网卡与发送用的AF_PACKET套接字
+ * 
+ * @param drv 网卡
+ */
+static void pcap_driver_close(driver_t *drv)
+{
+    pcap_priv_t *priv = drv->priv;
+    if (priv == NULL)
+        return;
+    pcap_close(priv->pcap);
+    if (priv->tx_fd >= 0)
+        close(priv->tx_fd);
+    free(priv);
+    drv->priv = NULL;
+}
+
+/**
+ * @brief libpcap网卡可供epoll等待的文件描述符
+ * 
+ * @param drv 网卡
+ * @param fds 存放文件描述符的数组
+ * @param max 数组长度
+ * @return int 文件描述符个数
+ */
+static int pcap_driver_fds(driver_t *drv, int *fds, int max)
+{
+    int fd = pcap_get_selectable_fd(((pcap_priv_t *)drv->priv)->pcap);
+    if (fd < 0 || max < 1)
+        return 0;
+    fds[0] = fd;
+    return 1;
+}
+
+/**
+ * @brief 生成过滤程序并通过pcap_setfilter()装入内核，替换原有的过滤程序
+ *        libpcap的bpf_insn与内核的sock_filter布局相同
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int pcap_driver_set_filter(driver_t *drv)
+{
+    struct bpf_insn insns[DRIVER_FILTER_MAX_INSNS];
+    struct bpf_program fp;
+    int n = driver_filter_build(drv, (struct sock_filter *)insns, DRIVER_FILTER_MAX_INSNS);
+    if (n < 0)
+        return -1;
+    fp.bf_len = n;
+    fp.bf_insns = insns;
+    pcap_t *pcap = ((pcap_priv_t *)drv->priv)->pcap;
+    if (pcap_setfilter(pcap, &fp) == -1)
+    {
+        fprintf(stderr, "Error in pcap_setfilter: %s\n", pcap_geterr(pcap));
+        return -1;
+    }
+    return 0;
+}
+
+const driver_ops_t driver_pcap_ops = {
+    .name = "pcap",
+    .open = pcap_driver_open,
+    .recv = pcap_driver_recv,
+    .recv_batch = pcap_driver_recv_batch,
+    .send = pcap_driver_send,
+    .send_batch = pcap_driver_send_batch,
+    .close = pcap_driver_close,
+    .fds = pcap_driver_fds,
+    .set_filter = pcap_driver_set_filter,
+};
+
+/**
+ * @brief 按名称选择网卡驱动后端，需在driver_open()之前调用
+ * 
+ * @param name 后端名称，如"pcap"、"tpacket"，可写作"tap:tap0"同时指定网卡名称，
+ *             file后端写作"file:输入文件[,out=输出文件][,loop=次数]"
+ * @return int 成功为0，未知的后端为-1
+ */
+int driver_select(const char *name)
+{
+    driver_t *drv = &net_if_current->driver;
+    const char *if_name = strchr(name, ':');
+    size_t len = if_name ? (size_t)(if_name - name) : strlen(name);
+    for (size_t i = 0; i < sizeof(driver_backends) / sizeof(driver_backends[0]); i++)
+        if (strlen(driver_backends[i]->name) == len && strncmp(driver_backends[i]->name, name, len) == 0)
+        {
+            drv->ops = driver_backends[i];
+            if (if_name && if_name[1])
+                snprintf(drv->if_name, sizeof(drv->if_name), "%s", if_name + 1);
+            return 0;
+        }
+    fprintf(stderr, "Unknown driver backend: %s\n", name);
+    return -1;
+}
+
+/**
+ * @brief 打开网卡，并装入按当前状态生成的内核过滤程序
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int driver_open()
+{
+    driver_t *drv = &net_if_current->driver;
+    if (drv->ops == NULL && driver_select(DRIVER_BACKEND) != 0)
+        return -1;
+    if (drv->tx_queue == NULL && (drv->tx_queue = net_mem_alloc(DRIVER_TX_QUEUE_LEN * sizeof(tx_slot_t))) == NULL)
+        return -1;
+    drv->tx_count = 0;
+    if (drv->ops->open(drv) != 0)
+        return -1;
+    drv->opened = 1;
+    if (drv->ops->set_filter && drv->ops->set_filter(drv) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief 试图从网卡接收数据包
+ * 
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0，错误为-1
+ */
+int driver_recv(buf_t *buf)
+{
+    driver_t *drv = &net_if_current->driver;
+    buf->csum = BUF_CSUM_NONE; //只有能给出校验和结论的后端才会改写
+    return drv->ops->recv(drv, buf);
+}
+
+/**
+ * @brief 试图从网卡一次接收一批数据包
+ *        后端不支持批量接收时，退化为多次调用driver_recv()
+ * 
+ * @param bufs 存放收到的数据包的数组
+ * @param n 数组长度，即最多接收的数据包个数
+ * @return int 收到的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_batch(buf_t *bufs, int n)
+{
+    driver_t *drv = &net_if_current->driver;
+    for (int i = 0; i < n; i++) //只有能给出校验和结论的后端才会改写
+        bufs[i].csum = BUF_CSUM_NONE;
+    if (drv->ops->recv_batch)
+        return drv->ops->recv_batch(drv, bufs, n);
+
+    int i = 0;
+    for (; i < n; i++)
+    {
+        int ret = drv->ops->recv(drv, &bufs[i]);
+        if (ret < 0)
+            return i ? i : -1;
+        if (ret == 0)
+            break;
+    }
+    return i;
+}
+
+/**
+ * @brief 试图从网卡零拷贝接收一批数据包
+ *        后端不支持零拷贝时，退化为拷贝到bufs中的数据包
+ * 
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数，后端可能返回更少的数据包
+ * @return int 收到的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_zc(buf_t *bufs, int n)
+{
+    driver_t *drv = &net_if_current->driver;
+    if (drv->ops->recv_zc)
+    {
+        for (int i = 0; i < n; i++) //突发数组由各网卡共用，放掉上一次拷贝接收留下的缓冲区与结论
+        {
+            buf_free(&bufs[i]);
+            bufs[i].next = NULL;
+            bufs[i].csum = BUF_CSUM_NONE;
+        }
+        return drv->ops->recv_zc(drv, bufs, n);
+    }
+    return driver_recv_batch(bufs, n);
+}
+
+/**
+ * @brief 协议栈已处理完driver_recv_zc()收到的数据包，把帧内存还给驱动
+ * 
+ */
+void driver_release()
+{
+    driver_t *drv = &net_if_current->driver;
+    if (drv->ops->release)
+        drv->ops->release(drv);
+}
+
+/**
+ * @brief 由多段组成的帧交给不支持批量发送的后端：只有一段时直接发送，否则先拼接到一个缓冲区中
+ * 
+ * @param drv 网卡
+ * @param frame 要发送的帧
+ * @return int 成功为0，失败为-1
+ */
+static int driver_send_frame(driver_t *drv, driver_frame_t *frame)
+{
+    buf_t buf = {.len = frame->iov[0].iov_len, .data = frame->iov[0].iov_base}; //只有一段时借用len与data字段
+    if (frame->iovcnt > 1)
+    {
+        if (buf_init(&buf, frame->len) < 0)
+            return -1;
+        uint8_t *p = buf.data;
+        for (int i = 0; i < frame->iovcnt; i++)
+        {
+            memcpy(p, frame->iov[i].iov_base, frame->iov[i].iov_len);
+            p += frame->iov[i].iov_len;
+        }
+    }
+    int ret = drv->ops->send(drv, &buf);
+    buf_free(&buf);
+    return ret;
+}
+
+/**
+ * @brief 立即把发送队列中的数据包全部发出，供对时延敏感的发送者使用
+ *        后端支持批量发送时一次提交整个队列，否则逐个发送
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int driver_flush()
+{
+    driver_t *drv = &net_if_current->driver;
+    int ret = 0;
+    if (drv->tx_count == 0)
+        return 0;
+
+    driver_frame_t frames[DRIVER_TX_QUEUE_LEN];
+    for (int i = 0; i < drv->tx_count; i++)
+    {
+        frames[i].iov = drv->tx_queue[i].iov;
+        frames[i].iovcnt = drv->tx_queue[i].iovcnt;
+        frames[i].len = drv->tx_queue[i].len;
+    }
+    if (drv->ops->send_batch)
+    {
+        if (drv->ops->send_batch(drv, frames, drv->tx_count) != drv->tx_count)
+            ret = -1;
+    }
+    else
+    {
+        for (int i = 0; i < drv->tx_count; i++)
+            if (driver_send_frame(drv, &frames[i]) != 0)
+                ret = -1;
+    }
+    drv->tx_count = 0;
+    return ret;
+}
+
+/**
+ * @brief 使用网卡发送一个数据包
+ *        数据包先拷贝进发送队列，在一次轮询结束、队列满或调用driver_flush()时批量发出；
+ *        链式数据包只拷贝第一段，其余各段在发送队列中只引用
+ * 
+ * @param buf 要发送的数据包，可以是链式数据包
+ * @return int 成功为0，失败为-1
+ */
+int driver_send(buf_t *buf)
+{
+    driver_t *drv = &net_if_current->driver;
+    int segs = 0, len = 0;
+    for (buf_t *seg = buf; seg != NULL; seg = seg->next)
+        segs++, len += seg->len;
+
+    if (buf->len > DRIVER_TX_SLOT_SIZE || segs > DRIVER_TX_MAX_SEGS) //放不进帧槽，保持顺序直接发送
+    {
+        int ret = driver_flush();
+        struct iovec iov[segs];
+        driver_frame_t frame = {iov, 0, len};
+        for (buf_t *seg = buf; seg != NULL; seg = seg->next)
+            iov[frame.iovcnt++] = (struct iovec){seg->data, seg->len};
+        if (drv->ops->send_batch)
+            return drv->ops->send_batch(drv, &frame, 1) == 1 ? ret : -1;
+        return driver_send_frame(drv, &frame) ? -1 : ret;
+    }
+
+    tx_slot_t *slot = &drv->tx_queue[drv->tx_count];
+    memcpy(slot->data, buf->data, buf->len);
+    slot->iov[0] = (struct iovec){slot->data, buf->len};
+    slot->iovcnt = 1;
+    for (buf_t *seg = buf->next; seg != NULL; seg = seg->next)
+        slot->iov[slot->iovcnt++] = (struct iovec){seg->data, seg->len};
+    slot->len = len;
+    if (++drv->tx_count == DRIVER_TX_QUEUE_LEN) //达到高水位，立即发送
+        return driver_flush();
+    return 0;
+}
+
+/**
+ * @brief 获取网卡可供epoll等待的文件描述符，有数据包到来时可读
+ * 
+ * @param fds 存放文件描述符的数组
+ * @param max 数组长度
+ * @return int 文件描述符个数，后端不支持时为0
+ */
+int driver_fds(int *fds, int max)
+{
+    driver_t *drv = &net_if_current->driver;
+    if (drv->ops->fds == NULL)
+        return 0;
+    return drv->ops->fds(drv, fds, max);
+}
+
 /**
  * @brief 关闭网卡
  * 
  */
 void driver_close()
 {
-    pcap_close(pcap);
+    driver_t *drv = &net_if_current->driver;
+    driver_flush();
+    drv->ops->close(drv); //发送队列在包内存区中，保留给再次打开时使用
+    drv->opened = 0;
+}
+
+/**
+ * @brief 更新当前网卡的内核过滤程序允许通过的udp端口，网卡已打开时立即重新生成并替换过滤程序
+ * 
+ * @param ports 已打开的udp端口
+ * @param n 端口数，不超过UDP_MAX_HANDLER
+ * @return int 成功为0，失败为-1
+ */
+int driver_set_filter(const uint16_t *ports, int n)
+{
+    driver_t *drv = &net_if_current->driver;
+    if (n > UDP_MAX_HANDLER)
+        return -1;
+    memcpy(drv->udp_ports, ports, n * sizeof(uint16_t));
+    drv->udp_port_nr = n;
+    if (!drv->opened || drv->ops->set_filter == NULL) //未打开时由driver_open()装入
+        return 0;
+    return drv->ops->set_filter(drv);
 }
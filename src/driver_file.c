@@ -0,0 +1,624 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include "utils.h"
+#include "config.h"
+#include "driver.h"
+
+#define PCAP_MAGIC_US 0xA1B2C3D4    //经典pcap，微秒时间戳
+#define PCAP_MAGIC_NS 0xA1B23C4D    //经典pcap，纳秒时间戳
+#define PCAPNG_SHB 0x0A0D0D0A       //pcapng节首部块
+#define PCAPNG_IDB 0x00000001       //pcapng接口描述块
+#define PCAPNG_SPB 0x00000003       //pcapng简单数据包块
+#define PCAPNG_EPB 0x00000006       //pcapng增强数据包块
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4D //pcapng字节序标记
+#define LINKTYPE_ETHERNET 1
+#define FILE_IF_MAX 64               //pcapng中每节最多记录的接口数
+
+/**
+ * @brief 文件后端的私有数据
+ *        输入文件以MAP_PRIVATE可写映射，协议栈可以原地改写帧；每轮回放结束时丢弃被改写的页，
+ *        下一轮重新从页缓存读到原始内容
+ *        输出文件通过一个滑动的内存映射窗口追加，先用ftruncate扩展文件，关闭时截断到实际长度
+ * 
+ */
+typedef struct file_dev
+{
+    uint8_t *map;      //输入文件的映射
+    size_t map_len;    //输入文件长度
+    size_t first;      //第一个记录（pcap）或第一个块（pcapng）的偏移
+    size_t off;        //下一个记录或块的偏移
+    int pcapng;        //输入是否为pcapng
+    int swap;          //输入的字节序是否与本机相反
+    uint64_t ether_ifs; //pcapng当前节中链路类型为以太网的接口位图
+    int if_nr;         //pcapng当前节中的接口数
+    int held;          //零拷贝交给协议栈、尚未归还的帧数
+    int loop;          //回放次数，0为无限次
+    int pass;          //已完成的回放次数
+    int done;          //回放已结束
+    int efd;           //eventfd，回放期间可读，结束后清空，使事件循环不再被唤醒
+    uint64_t frames;   //已回放的帧数
+    uint64_t bytes;    //已回放的字节数
+    struct timespec start; //开始回放的时刻
+
+    int out_fd;        //输出文件，-1表示不录制
+    uint8_t *win;      //输出窗口的映射，NULL表示尚未映射
+    off_t win_off;     //输出窗口在文件中的偏移，按页对齐
+    size_t win_pos;    //下一个记录在窗口中的位置
+} file_dev_t;
+
+static inline uint32_t file_u32(const file_dev_t *f, const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return f->swap ? __builtin_bswap32(v) : v;
+}
+
+static inline uint16_t file_u16(const file_dev_t *f, const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return f->swap ? __builtin_bswap16(v) : v;
+}
+
+/**
+ * @brief 解析pcapng节首部块，确定本节的字节序并清空接口表
+ * 
+ * @param f 文件后端
+ * @param p 块的起始地址
+ * @return int 成功为0，字节序标记不正确为-1
+ */
+static int file_pcapng_section(file_dev_t *f, const uint8_t *p)
+{
+    uint32_t bom;
+    memcpy(&bom, p + 8, 4);
+    if (bom == PCAPNG_BYTE_ORDER)
+        f->swap = 0;
+    else if (bom == __builtin_bswap32(PCAPNG_BYTE_ORDER))
+        f->swap = 1;
+    else
+        return -1;
+    f->ether_ifs = 0;
+    f->if_nr = 0;
+    return 0;
+}
+
+/**
+ * @brief 解析输入文件的文件头
+ * 
+ * @param f 文件后端，map与map_len已填写
+ * @param name 文件名，用于提示
+ * @return int 成功为0，格式不支持为-1
+ */
+static int file_parse_header(file_dev_t *f, const char *name)
+{
+    uint32_t magic;
+    if (f->map_len < 24)
+    {
+        fprintf(stderr, "Error in file driver: %s is too short\n", name);
+        return -1;
+    }
+    memcpy(&magic, f->map, 4);
+    if (magic == PCAPNG_SHB)
+    {
+        f->pcapng = 1;
+        f->first = f->off = 0;
+        if (file_pcapng_section(f, f->map) < 0)
+        {
+            fprintf(stderr, "Error in file driver: bad pcapng byte-order magic in %s\n", name);
+            return -1;
+        }
+        return 0;
+    }
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS)
+        f->swap = 0;
+    else if (magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS))
+        f->swap = 1;
+    else
+    {
+        fprintf(stderr, "Error in file driver: %s is not a pcap or pcapng file\n", name);
+        return -1;
+    }
+    uint32_t linktype = file_u32(f, f->map + 20) & 0x0FFFFFFF;
+    if (linktype != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "Error in file driver: %s has link type %u, only Ethernet is supported\n", name, linktype);
+        return -1;
+    }
+    f->pcapng = 0;
+    f->first = f->off = 24;
+    return 0;
+}
+
+/**
+ * @brief 在映射中原地取下一帧，跳过不是以太网或超过UINT16_MAX字节的记录
+ * 
+ * @param f 文件后端
+ * @param len 帧长度
+ * @return uint8_t* 帧的起始地址，已到文件末尾（或文件被截断）时为NULL
+ */
+static uint8_t *file_next(file_dev_t *f, uint16_t *len)
+{
+    while (1)
+    {
+        size_t left = f->map_len - f->off;
+        uint8_t *p = f->map + f->off;
+        uint32_t caplen;
+        uint8_t *data;
+        if (!f->pcapng)
+        {
+            if (left < 16)
+                return NULL;
+            caplen = file_u32(f, p + 8);
+            if (caplen > left - 16)
+                return NULL;
+            f->off += 16 + caplen;
+            data = p + 16;
+        }
+        else
+        {
+            if (left < 12)
+                return NULL;
+            uint32_t type, blen;
+            memcpy(&type, p, 4);
+            if (type == PCAPNG_SHB && file_pcapng_section(f, p) < 0)
+                return NULL;
+            blen = file_u32(f, p + 4);
+            if (blen < 12 || blen > left || blen % 4)
+                return NULL;
+            f->off += blen;
+            type = file_u32(f, p);
+            if (type == PCAPNG_IDB)
+            {
+                if (blen >= 20 && f->if_nr < FILE_IF_MAX && file_u16(f, p + 8) == LINKTYPE_ETHERNET)
+                    f->ether_ifs |= 1ULL << f->if_nr;
+                f->if_nr++;
+                continue;
+            }
+            else if (type == PCAPNG_EPB && blen >= 32)
+            {
+                uint32_t if_id = file_u32(f, p + 8);
+                if (if_id >= FILE_IF_MAX || !(f->ether_ifs >> if_id & 1))
+                    continue;
+                caplen = file_u32(f, p + 20);
+                if (caplen > blen - 32)
+                    continue;
+                data = p + 28;
+            }
+            else if (type == PCAPNG_SPB && blen >= 16)
+            {
+                if (!(f->ether_ifs & 1))
+                    continue;
+                caplen = file_u32(f, p + 8);
+                if (caplen > blen - 16)
+                    caplen = blen - 16;
+                data = p + 12;
+            }
+            else
+                continue;
+        }
+        if (caplen == 0 || caplen > UINT16_MAX) //帧长度以uint16_t交出，更长的记录跳过而不是截断
+            continue;
+        *len = caplen;
+        return data;
+    }
+}
+
+/**
+ * @brief 输出回放统计
+ * 
+ * @param f 文件后端
+ */
+static void file_report(file_dev_t *f)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double sec = (now.tv_sec - f->start.tv_sec) + (now.tv_nsec - f->start.tv_nsec) / 1e9;
+    if (sec <= 0)
+        sec = 1e-9;
+    printf("file driver: replayed %llu frames, %llu bytes in %.3f s, %.3f Mpps, %.3f Gbit/s\n",
+           (unsigned long long)f->frames, (unsigned long long)f->bytes, sec,
+           f->frames / sec / 1e6, f->bytes * 8 / sec / 1e9);
+    fflush(stdout);
+}
+
+static void file_out_sync(file_dev_t *f);
+
+/**
+ * @brief 当前一轮回放到达文件末尾
+ *        还有下一轮时丢弃被改写的页并从头开始，否则结束回放、输出统计并截断输出文件
+ * 
+ * @param f 文件后端
+ * @return int 从头开始为1，回放结束为0
+ */
+static int file_rewind(file_dev_t *f)
+{
+    f->pass++;
+    if ((f->loop == 0 || f->pass < f->loop) && f->frames > 0) //没有帧的文件不再循环
+    {
+        madvise(f->map, f->map_len, MADV_DONTNEED); //私有映射丢弃写时复制的页，之后重新读到文件内容
+        f->off = f->first;
+        if (f->pcapng)
+            file_pcapng_section(f, f->map);
+        return 1;
+    }
+    uint64_t v;
+    f->done = 1;
+    if (read(f->efd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+        perror("Error in file driver: read eventfd");
+    file_report(f);
+    file_out_sync(f);
+    return 0;
+}
+
+/**
+ * @brief 零拷贝接收一批帧，IP头自然对齐的帧数据直接指向输入文件的映射，其余的拷贝到缓冲池中
+ *        到达末尾时只在已归还所有帧后才开始下一轮，避免丢弃协议栈还在使用的页
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组，只填写len与data（拷贝时由buf_init_frame()填写）
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int file_driver_recv_zc(driver_t *drv, buf_t *bufs, int n)
+{
+    file_dev_t *f = drv->priv;
+    int i = 0;
+    while (i < n && !f->done)
+    {
+        uint16_t len;
+        uint8_t *data = file_next(f, &len);
+        if (data == NULL)
+        {
+            if (i > 0 || f->held > 0 || !file_rewind(f))
+                break;
+            continue;
+        }
+        if (((uintptr_t)data - NET_IP_ALIGN) & 3) //记录紧密排列，IP头不对齐的帧拷贝到缓冲池中，不改写映射，页不会被写时复制
+        {
+            if (buf_init_frame(&bufs[i], len) < 0) //缓冲池用尽，丢弃
+                continue;
+            memcpy(bufs[i].data, data, len);
+        }
+        else
+            bufs[i].data = data;
+        bufs[i].len = len;
+        f->frames++;
+        f->bytes += len;
+        i++;
+    }
+    f->held += i;
+    return i;
+}
+
+/**
+ * @brief 归还零拷贝接收的帧
+ * 
+ * @param drv 网卡
+ */
+static void file_driver_release(driver_t *drv)
+{
+    file_dev_t *f = drv->priv;
+    f->held = 0;
+}
+
+/**
+ * @brief 拷贝接收一批帧
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int file_driver_recv_batch(driver_t *drv, buf_t *bufs, int n)
+{
+    file_dev_t *f = drv->priv;
+    int i = 0;
+    while (i < n && !f->done)
+    {
+        uint16_t len;
+        uint8_t *data = file_next(f, &len);
+        if (data == NULL)
+        {
+            if (f->held > 0 || !file_rewind(f))
+                break;
+            continue;
+        }
+        if (buf_init_frame(&bufs[i], len) < 0) //缓冲池用尽，丢弃
+            continue;
+        memcpy(bufs[i].data, data, len);
+        f->frames++;
+        f->bytes += len;
+        i++;
+    }
+    return i;
+}
+
+/**
+ * @brief 拷贝接收一帧
+ * 
+ * @param drv 网卡
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int file_driver_recv(driver_t *drv, buf_t *buf)
+{
+    return file_driver_recv_batch(drv, buf, 1) ? buf->len : 0;
+}
+
+/**
+ * @brief 映射从win_off开始的输出窗口，必要时先扩展文件
+ * 
+ * @param f 文件后端
+ * @return int 成功为0，失败为-1
+ */
+static int file_out_map(file_dev_t *f)
+{
+    if (ftruncate(f->out_fd, f->win_off + DRIVER_FILE_OUT_WINDOW) < 0)
+    {
+        perror("Error in file driver: ftruncate");
+        return -1;
+    }
+    f->win = mmap(NULL, DRIVER_FILE_OUT_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, f->out_fd, f->win_off);
+    if (f->win == MAP_FAILED)
+    {
+        f->win = NULL;
+        perror("Error in file driver: mmap output");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 解除输出窗口的映射并把文件截断到已写入的长度，使输出文件随时都是完整的pcap
+ * 
+ * @param f 文件后端
+ */
+static void file_out_sync(file_dev_t *f)
+{
+    if (f->win == NULL)
+        return;
+    munmap(f->win, DRIVER_FILE_OUT_WINDOW);
+    f->win = NULL;
+    if (ftruncate(f->out_fd, f->win_off + f->win_pos) < 0)
+        perror("Error in file driver: ftruncate");
+}
+
+/**
+ * @brief 把一帧以pcap记录追加到输出窗口，窗口放不下时向后滑动
+ * 
+ * @param f 文件后端
+ * @param iov 帧的各段
+ * @param iovcnt 段数
+ * @param len 帧长度
+ * @return int 成功为0，失败为-1
+ */
+static int file_out_write(file_dev_t *f, const struct iovec *iov, int iovcnt, size_t len)
+{
+    size_t need = 16 + len;
+    if (f->win != NULL && f->win_pos + need > DRIVER_FILE_OUT_WINDOW)
+    {
+        munmap(f->win, DRIVER_FILE_OUT_WINDOW);
+        f->win = NULL;
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t slide = f->win_pos & ~(page - 1);
+        f->win_off += slide;
+        f->win_pos -= slide;
+    }
+    if (f->win == NULL && file_out_map(f) < 0)
+        return -1;
+    uint32_t hdr[4] = {0, 0, len, len}; //与离线测试驱动一致，时间戳为0
+    uint8_t *p = f->win + f->win_pos;
+    memcpy(p, hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    for (int i = 0; i < iovcnt; i++)
+    {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    f->win_pos += need;
+    return 0;
+}
+
+/**
+ * @brief 把一帧写入输出文件，不录制时直接丢弃
+ * 
+ * @param drv 网卡
+ * @param buf 要发送的数据包
+ * @return int 成功为0，失败为-1
+ */
+static int file_driver_send(driver_t *drv, buf_t *buf)
+{
+    file_dev_t *f = drv->priv;
+    if (f->out_fd < 0)
+        return 0;
+    struct iovec iov = {buf->data, buf->len};
+    if (file_out_write(f, &iov, 1, buf->len) < 0)
+        return -1;
+    if (f->done) //回放结束后发出的帧很少，每次都截断，使输出文件保持完整
+        file_out_sync(f);
+    return 0;
+}
+
+/**
+ * @brief 把一批帧写入输出文件
+ * 
+ * @param drv 网卡
+ * @param frames 要发送的帧
+ * @param n 帧的个数
+ * @return int 成功写入的帧数，错误为-1
+ */
+static int file_driver_send_batch(driver_t *drv, driver_frame_t *frames, int n)
+{
+    file_dev_t *f = drv->priv;
+    if (f->out_fd < 0)
+        return n;
+    int i = 0;
+    for (; i < n; i++)
+        if (file_out_write(f, frames[i].iov, frames[i].iovcnt, frames[i].len) < 0)
+            break;
+    if (f->done)
+        file_out_sync(f);
+    return i == 0 && n > 0 ? -1 : i;
+}
+
+/**
+ * @brief 创建输出文件并映射第一个窗口，写入经典pcap文件头
+ * 
+ * @param f 文件后端
+ * @param name 输出文件名
+ * @return int 成功为0，失败为-1
+ */
+static int file_out_open(file_dev_t *f, const char *name)
+{
+    f->out_fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (f->out_fd < 0)
+    {
+        fprintf(stderr, "Error in file driver: open %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    if (file_out_map(f) < 0)
+        return -1;
+    uint32_t hdr[6] = {PCAP_MAGIC_US, 2 | 4 << 16, 0, 0, BUF_MAX_LEN, LINKTYPE_ETHERNET};
+    memcpy(f->win, hdr, sizeof(hdr));
+    f->win_pos = sizeof(hdr);
+    return 0;
+}
+
+/**
+ * @brief 关闭文件网卡：截断输出文件并释放映射
+ * 
+ * @param drv 网卡
+ */
+static void file_driver_close(driver_t *drv)
+{
+    file_dev_t *f = drv->priv;
+    if (f == NULL)
+        return;
+    if (f->out_fd >= 0)
+    {
+        file_out_sync(f);
+        close(f->out_fd);
+    }
+    if (f->map != NULL && f->map != MAP_FAILED)
+        munmap(f->map, f->map_len);
+    if (f->efd >= 0)
+        close(f->efd);
+    free(f);
+    drv->priv = NULL;
+}
+
+/**
+ * @brief 打开文件网卡
+ *        if_name形如"输入文件[,out=输出文件][,loop=次数]"，loop默认为1，0表示无限循环
+ *        输入支持经典pcap（两种字节序、微秒或纳秒时间戳）与pcapng，链路类型必须是以太网
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int file_driver_open(driver_t *drv)
+{
+    char spec[DRIVER_NAME_LEN];
+    const char *out = NULL;
+    file_dev_t *f = calloc(1, sizeof(file_dev_t));
+    if (f == NULL)
+        return -1;
+    f->out_fd = f->efd = -1;
+    f->loop = 1;
+    drv->priv = f;
+
+    snprintf(spec, sizeof(spec), "%s", drv->if_name);
+    char *in = strtok(spec, ",");
+    for (char *opt = strtok(NULL, ","); opt != NULL; opt = strtok(NULL, ","))
+    {
+        if (strncmp(opt, "out=", 4) == 0)
+            out = opt + 4;
+        else if (strncmp(opt, "loop=", 5) == 0)
+            f->loop = atoi(opt + 5);
+        else
+        {
+            fprintf(stderr, "Error in file driver: unknown option %s\n", opt);
+            goto fail;
+        }
+    }
+    if (in == NULL || f->loop < 0)
+    {
+        fprintf(stderr, "Error in file driver: usage file:in.pcap[,out=out.pcap][,loop=N]\n");
+        goto fail;
+    }
+
+    int fd = open(in, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "Error in file driver: open %s: %s\n", in, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        goto fail;
+    }
+    f->map_len = st.st_size;
+    f->map = f->map_len ? mmap(NULL, f->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (f->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error in file driver: mmap %s: %s\n", in, f->map_len ? strerror(errno) : "empty file");
+        goto fail;
+    }
+    madvise(f->map, f->map_len, MADV_SEQUENTIAL);
+    if (file_parse_header(f, in) < 0)
+        goto fail;
+
+    if (out != NULL && file_out_open(f, out) < 0)
+        goto fail;
+
+    uint64_t one = 1;
+    f->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (f->efd < 0 || write(f->efd, &one, sizeof(one)) < 0)
+    {
+        perror("Error in file driver: eventfd");
+        goto fail;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &f->start);
+    return 0;
+
+fail:
+    file_driver_close(drv);
+    return -1;
+}
+
+/**
+ * @brief 可供epoll等待的文件描述符：回放期间一直可读，结束后事件循环只等待定时器
+ * 
+ * @param drv 网卡
+ * @param fds 存放文件描述符的数组
+ * @param max 数组长度
+ * @return int 文件描述符个数
+ */
+static int file_driver_fds(driver_t *drv, int *fds, int max)
+{
+    file_dev_t *f = drv->priv;
+    if (max < 1)
+        return 0;
+    fds[0] = f->efd;
+    return 1;
+}
+
+const driver_ops_t driver_file_ops = {
+    .name = "file",
+    .open = file_driver_open,
+    .recv = file_driver_recv,
+    .recv_batch = file_driver_recv_batch,
+    .recv_zc = file_driver_recv_zc,
+    .release = file_driver_release,
+    .send = file_driver_send,
+    .send_batch = file_driver_send_batch,
+    .close = file_driver_close,
+    .fds = file_driver_fds,
+};
@@ -0,0 +1,78 @@
+#include <string.h>
+#include <linux/filter.h>
+#include "utils.h"
+#include "config.h"
+#include "driver.h"
+
+#define FILTER_STMT(code, k) ((struct sock_filter){(code), 0, 0, (k)})
+#define FILTER_JUMP(code, k, jt, jf) ((struct sock_filter){(code), (jt), (jf), (k)})
+
+/**
+ * @brief 由协议栈当前状态生成经典BPF过滤程序，供libpcap、AF_PACKET与TAP后端装入内核
+ *        只放行发往本网卡或广播、且不是本网卡发出的帧；
+ *        DRIVER_KERNEL_FILTER为1时进一步只放行ARP，以及目的ip为本机的ICMP、非首个分片、目的端口已打开的UDP
+ *        生成的程序形如：
+ *            ld [2]; jeq #mac[2..5] ... ; ldh [0]; jeq #mac[0..1] ...   目的mac
+ *            ld [8]; ...                                              源mac不是本网卡
+ *            ldh [12]; jeq #0x806 accept; jeq #0x800, 0, drop           类型
+ *            ld [30]; jeq #ip, 0, drop                                目的ip
+ *            ldb [23]; jeq #1 accept; jeq #17, 0, drop                协议
+ *            ldh [20]; jset #0x1fff accept                            非首个分片没有UDP首部
+ *            ldxb 4*([14]&0xf); ldh [x+16]; jeq #port accept ...      UDP目的端口
+ *        drop: ret #0
+ *        accept: ret #-1
+ * 
+ * @param drv 网卡，使用其中的mac、ip与已打开的udp端口
+ * @param prog 存放生成的程序
+ * @param max prog的长度，不小于DRIVER_FILTER_MAX_INSNS即可
+ * @return int 指令条数，prog放不下时为-1
+ */
+int driver_filter_build(const driver_t *drv, struct sock_filter *prog, int max)
+{
+    const uint8_t *mac = drv->mac;
+    uint32_t mac_lo = (uint32_t)mac[2] << 24 | mac[3] << 16 | mac[4] << 8 | mac[5];
+    uint32_t mac_hi = mac[0] << 8 | mac[1];
+    int len = DRIVER_KERNEL_FILTER ? 25 + drv->udp_port_nr : 14;
+    int drop = len - 2, accept = len - 1;
+    int n = 0;
+    if (len > max)
+        return -1;
+
+#define TO(label) ((label) - n - 1) //从第n条指令跳到label的偏移
+    //目的mac为本网卡或广播
+    prog[n] = FILTER_STMT(BPF_LD | BPF_W | BPF_ABS, 2), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_lo, 0, 2), n++;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_H | BPF_ABS, 0), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_hi, 3, TO(drop)), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xFFFFFFFF, 0, TO(drop)), n++;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_H | BPF_ABS, 0), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xFFFF, 0, TO(drop)), n++;
+    //源mac不是本网卡
+    prog[n] = FILTER_STMT(BPF_LD | BPF_W | BPF_ABS, 8), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_lo, 0, 2), n++;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_H | BPF_ABS, 6), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_hi, TO(drop), 0), n++;
+#if DRIVER_KERNEL_FILTER
+    const uint8_t *ip = drv->ip;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_H | BPF_ABS, 12), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0806, TO(accept), 0), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0800, 0, TO(drop)), n++;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_W | BPF_ABS, 30), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)ip[0] << 24 | ip[1] << 16 | ip[2] << 8 | ip[3], 0, TO(drop)), n++;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_B | BPF_ABS, 23), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, TO(accept), 0), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 17, 0, TO(drop)), n++;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_H | BPF_ABS, 20), n++;
+    prog[n] = FILTER_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, TO(accept), 0), n++;
+    prog[n] = FILTER_STMT(BPF_LDX | BPF_B | BPF_MSH, 14), n++;
+    prog[n] = FILTER_STMT(BPF_LD | BPF_H | BPF_IND, 16), n++;
+    for (int i = 0; i < drv->udp_port_nr; i++)
+        prog[n] = FILTER_JUMP(BPF_JMP | BPF_JEQ | BPF_K, drv->udp_ports[i], TO(accept), 0), n++;
+#else
+    prog[n] = FILTER_STMT(BPF_JMP | BPF_JA, TO(accept)), n++;
+#endif
+#undef TO
+    prog[n++] = FILTER_STMT(BPF_RET | BPF_K, 0);
+    prog[n++] = FILTER_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+    return n;
+}
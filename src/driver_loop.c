@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "utils.h"
+#include "config.h"
+#include "driver.h"
+
+/**
+ * @brief 环形队列中的一个帧槽
+ *        帧槽8字节对齐，帧数据前的长度字段正好占NET_IP_ALIGN字节，零拷贝接收时IP头自然对齐
+ * 
+ */
+typedef struct loop_slot
+{
+    _Alignas(8) uint16_t len;            //帧长度
+    uint8_t data[DRIVER_LOOP_SLOT_SIZE]; //帧数据
+} loop_slot_t;
+_Static_assert(offsetof(loop_slot_t, data) == NET_IP_ALIGN, "loop slot data must start at NET_IP_ALIGN");
+
+/**
+ * @brief 单生产者单消费者的无锁环形队列
+ *        head只由生产者写，tail只由消费者写，分别放在不同的缓存行上
+ * 
+ */
+typedef struct loop_ring
+{
+    _Alignas(64) uint32_t head;                     //下一个要写入的位置
+    _Alignas(64) uint32_t tail;                     //下一个要读出的位置
+    _Alignas(64) loop_slot_t slots[DRIVER_LOOP_RING_SIZE]; //帧槽
+} loop_ring_t;
+
+static loop_ring_t *loop_rx;        //发生器线程 -> 协议栈，打开时从包内存区分配
+static loop_ring_t *loop_tx;        //协议栈 -> 接收线程
+static uint32_t loop_rx_held;       //零拷贝交给协议栈、尚未归还的帧数
+static uint64_t loop_tx_drops;      //发送队列满而丢弃的帧数
+
+/**
+ * @brief 向环形队列写入一帧，各段依次拷贝进同一个帧槽
+ * 
+ * @param ring 环形队列
+ * @param iov 帧的各段
+ * @param iovcnt 段数
+ * @param len 帧长度
+ * @return int 成功为0，队列满或帧过长为-1
+ */
+static int loop_ring_put(loop_ring_t *ring, const struct iovec *iov, int iovcnt, uint16_t len)
+{
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == DRIVER_LOOP_RING_SIZE || len > DRIVER_LOOP_SLOT_SIZE)
+        return -1;
+    loop_slot_t *slot = &ring->slots[head & (DRIVER_LOOP_RING_SIZE - 1)];
+    uint8_t *p = slot->data;
+    slot->len = len;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief 打开内存回环网卡，清空两个环形队列
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，包内存区分配失败为-1
+ */
+static int loop_driver_open(driver_t *drv)
+{
+    (void)drv; //内存回环后端只有一组全局队列，不区分网卡
+    if (loop_rx == NULL && (loop_rx = net_mem_alloc(sizeof(loop_ring_t))) == NULL)
+        return -1;
+    if (loop_tx == NULL && (loop_tx = net_mem_alloc(sizeof(loop_ring_t))) == NULL)
+        return -1;
+    loop_rx->head = loop_rx->tail = 0;
+    loop_tx->head = loop_tx->tail = 0;
+    loop_rx_held = 0;
+    loop_tx_drops = 0;
+    return 0;
+}
+
+/**
+ * @brief 从接收队列零拷贝取一批帧，帧槽在loop_driver_release()之前不会被发生器线程覆盖
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组，只填写len与data
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int loop_driver_recv_zc(driver_t *drv, buf_t *bufs, int n)
+{
+    (void)drv;
+    uint32_t tail = loop_rx->tail + loop_rx_held;
+    uint32_t avail = __atomic_load_n(&loop_rx->head, __ATOMIC_ACQUIRE) - tail;
+    int i = 0;
+    for (; i < n && (uint32_t)i < avail; i++)
+    {
+        loop_slot_t *slot = &loop_rx->slots[(tail + i) & (DRIVER_LOOP_RING_SIZE - 1)];
+        bufs[i].data = slot->data;
+        bufs[i].len = slot->len;
+    }
+    loop_rx_held += i;
+    return i;
+}
+
+/**
+ * @brief 把零拷贝交给协议栈的帧槽还给发生器线程
+ * 
+ * @param drv 网卡
+ */
+static void loop_driver_release(driver_t *drv)
+{
+    (void)drv;
+    __atomic_store_n(&loop_rx->tail, loop_rx->tail + loop_rx_held, __ATOMIC_RELEASE);
+    loop_rx_held = 0;
+}
+
+/**
+ * @brief 从接收队列拷贝取一批帧
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int loop_driver_recv_batch(driver_t *drv, buf_t *bufs, int n)
+{
+    (void)drv;
+    uint32_t tail = loop_rx->tail;
+    uint32_t avail = __atomic_load_n(&loop_rx->head, __ATOMIC_ACQUIRE) - tail;
+    int i = 0, got = 0;
+    for (; i < n && (uint32_t)i < avail; i++)
+    {
+        loop_slot_t *slot = &loop_rx->slots[(tail + i) & (DRIVER_LOOP_RING_SIZE - 1)];
+        if (buf_init_frame(&bufs[got], slot->len) < 0) //缓冲池用尽，丢弃
+            continue;
+        memcpy(bufs[got++].data, slot->data, slot->len);
+    }
+    __atomic_store_n(&loop_rx->tail, tail + i, __ATOMIC_RELEASE);
+    return got;
+}
+
+/**
+ * @brief 从接收队列拷贝取一帧
+ * 
+ * @param drv 网卡
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int loop_driver_recv(driver_t *drv, buf_t *buf)
+{
+    return loop_driver_recv_batch(drv, buf, 1) ? buf->len : 0;
+}
+
+/**
+ * @brief 把一帧写入发送队列，队列满时丢弃并计数
+ * 
+ * @param drv 网卡
+ * @param buf 要发送的数据包
+ * @return int 成功为0，丢弃为-1
+ */
+static int loop_driver_send(driver_t *drv, buf_t *buf)
+{
+    (void)drv;
+    struct iovec iov = {buf->data, buf->len};
+    if (loop_ring_put(loop_tx, &iov, 1, buf->len) == 0)
+        return 0;
+    loop_tx_drops++;
+    return -1;
+}
+
+/**
+ * @brief 把一批帧写入发送队列
+ * 
+ * @param drv 网卡
+ * @param frames 要发送的帧
+ * @param n 帧的个数
+ * @return int 成功写入的帧数
+ */
+static int loop_driver_send_batch(driver_t *drv, driver_frame_t *frames, int n)
+{
+    (void)drv;
+    int sent = 0;
+    for (int i = 0; i < n; i++)
+        if (loop_ring_put(loop_tx, frames[i].iov, frames[i].iovcnt, frames[i].len) == 0)
+            sent++;
+        else
+            loop_tx_drops++;
+    return sent;
+}
+
+/**
+ * @brief 关闭内存回环网卡
+ * 
+ * @param drv 网卡
+ */
+static void loop_driver_close(driver_t *drv)
+{
+    (void)drv;
+}
+
+const driver_ops_t driver_loop_ops = {
+    .name = "loop",
+    .open = loop_driver_open,
+    .recv = loop_driver_recv,
+    .recv_batch = loop_driver_recv_batch,
+    .recv_zc = loop_driver_recv_zc,
+    .release = loop_driver_release,
+    .send = loop_driver_send,
+    .send_batch = loop_driver_send_batch,
+    .close = loop_driver_close,
+};
+
+/**
+ * @brief 由发生器线程调用，向协议栈注入一帧
+ * 
+ * @param frame 帧数据
+ * @param len 帧长度
+ * @return int 成功为0，接收队列满为-1
+ */
+int driver_loop_produce(const uint8_t *frame, uint16_t len)
+{
+    struct iovec iov = {(void *)frame, len};
+    if (loop_rx == NULL) //网卡尚未打开
+        return -1;
+    return loop_ring_put(loop_rx, &iov, 1, len);
+}
+
+/**
+ * @brief 由接收线程调用，取走协议栈发出的帧
+ * 
+ * @param sink 对每一帧调用的处理函数，可为NULL
+ * @param arg 传给处理函数的参数
+ * @param max 最多取走的帧数
+ * @return int 取走的帧数
+ */
+int driver_loop_consume(driver_loop_sink_t sink, void *arg, int max)
+{
+    if (loop_tx == NULL)
+        return 0;
+    uint32_t tail = loop_tx->tail;
+    uint32_t avail = __atomic_load_n(&loop_tx->head, __ATOMIC_ACQUIRE) - tail;
+    int i = 0;
+    for (; i < max && (uint32_t)i < avail; i++)
+    {
+        loop_slot_t *slot = &loop_tx->slots[(tail + i) & (DRIVER_LOOP_RING_SIZE - 1)];
+        if (sink)
+            sink(slot->data, slot->len, arg);
+    }
+    __atomic_store_n(&loop_tx->tail, tail + i, __ATOMIC_RELEASE);
+    return i;
+}
+
+/**
+ * @brief 发送队列满而丢弃的帧数
+ * 
+ * @return uint64_t 丢弃的帧数
+ */
+uint64_t driver_loop_tx_drops()
+{
+    return loop_tx_drops;
+}
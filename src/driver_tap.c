@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <linux/virtio_net.h>
+#include <linux/filter.h>
+#include "utils.h"
+#include "config.h"
+#include "driver.h"
+#include "net.h"
+
+/**
+ * @brief TAP后端的私有数据
+ *        每个队列对应一个/dev/net/tun文件描述符，多队列时内核按流把帧分散到各个队列
+ * 
+ */
+typedef struct tap_dev
+{
+    int fds[DRIVER_TAP_QUEUES]; //各个队列的文件描述符
+    int queues;                 //队列数
+    int next;                   //下一次从哪个队列开始接收
+    int vnet_hdr;               //收发的每帧前都带有virtio_net_hdr，接收时由其flags得到校验和结论
+    int frame_len;              //接收缓冲区的长度，即打开时网络接口的mtu加上以太网头
+} tap_dev_t;
+
+/**
+ * @brief 把TAP网卡的mtu设为与网络接口相同并设为up，使内核不会交来比接收缓冲区长的帧；
+ *        失败时只给出提示，可以手动执行ip link set mtu/up
+ * 
+ * @param if_name 网卡名称
+ * @param mtu 网络接口的mtu
+ */
+static void tap_link_up(const char *if_name, int mtu)
+{
+    struct ifreq ifr;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        return;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+    ifr.ifr_mtu = mtu;
+    if (ioctl(sock, SIOCSIFMTU, &ifr) < 0)
+        fprintf(stderr, "Warning: failed to set the mtu of %s to %d: %s\n", if_name, mtu, strerror(errno));
+    if (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0)
+    {
+        ifr.ifr_flags |= IFF_UP;
+        if (ioctl(sock, SIOCSIFFLAGS, &ifr) < 0)
+            fprintf(stderr, "Warning: failed to bring %s up: %s\n", if_name, strerror(errno));
+    }
+    close(sock);
+}
+
+/**
+ * @brief 关闭TAP网卡
+ * 
+ * @param drv 网卡
+ */
+static void tap_driver_close(driver_t *drv)
+{
+    tap_dev_t *tap = drv->priv;
+    if (tap == NULL)
+        return;
+    for (int i = 0; i < tap->queues; i++)
+        close(tap->fds[i]);
+    free(tap);
+    drv->priv = NULL;
+}
+
+/**
+ * @brief 打开（不存在时创建）TAP网卡
+ *        不需要混杂模式与BPF过滤，内核只把发往该网卡的帧交给协议栈；
+ *        采信校验和结论时开启IFF_VNET_HDR，并以TUN_F_CSUM让内核不必替协议栈计算本机发出的帧的校验和
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int tap_driver_open(driver_t *drv)
+{
+    tap_dev_t *tap = calloc(1, sizeof(tap_dev_t));
+    if (tap == NULL)
+        return -1;
+    drv->priv = tap;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    if (DRIVER_TAP_QUEUES > 1)
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    if (drv->rx_csum_offload)
+        ifr.ifr_flags |= IFF_VNET_HDR;
+    tap->vnet_hdr = drv->rx_csum_offload;
+    tap->frame_len = net_if_current->mtu + 14;
+    strncpy(ifr.ifr_name, drv->if_name, IFNAMSIZ - 1);
+
+    for (; tap->queues < DRIVER_TAP_QUEUES; tap->queues++)
+    {
+        int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Error in open(/dev/net/tun): %s\n", strerror(errno));
+            goto fail;
+        }
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+        {
+            fprintf(stderr, "Error in ioctl(TUNSETIFF, %s): %s\n", drv->if_name, strerror(errno));
+            close(fd);
+            goto fail;
+        }
+        tap->fds[tap->queues] = fd;
+        if (tap->vnet_hdr && ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0)
+            fprintf(stderr, "Warning: ioctl(TUNSETOFFLOAD) failed on %s: %s\n", drv->if_name, strerror(errno));
+    }
+    tap_link_up(drv->if_name, net_if_current->mtu);
+    return 0;
+
+fail:
+    tap_driver_close(drv); //已打开的队列一并关闭
+    return -1;
+}
+
+/**
+ * @brief 从一个TAP队列读一帧
+ *        与其它后端一致，只处理发往本网卡与广播的数据帧；
+ *        带virtio_net_hdr时，DATA_VALID（已校验）与NEEDS_CSUM（本机发出、校验和未填写）的帧标记为BUF_CSUM_VALID
+ * 
+ * @param tap TAP网卡
+ * @param fd 队列的文件描述符
+ * @param if_mac 本网卡的mac地址
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，该队列暂时没有数据为0，错误为-1
+ */
+static int tap_read(tap_dev_t *tap, int fd, const uint8_t *if_mac, buf_t *buf)
+{
+    static const uint8_t bc_mac[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    struct virtio_net_hdr vnet;
+
+    for (;;)
+    {
+        if (buf_init_frame(buf, tap->frame_len) < 0) //缓冲池用尽，留在队列中下次再读
+            return 0;
+        struct iovec iov[2] = {{&vnet, sizeof(vnet)}, {buf->data, buf->len}};
+        ssize_t len = readv(fd, iov + !tap->vnet_hdr, 1 + tap->vnet_hdr);
+        if (len < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error in driver_recv: %s\n", strerror(errno));
+            return -1;
+        }
+        if (tap->vnet_hdr)
+            len -= sizeof(vnet);
+        if (len < 14 || (memcmp(buf->data, if_mac, 6) && memcmp(buf->data, bc_mac, 6)))
+            continue;
+        if (tap->vnet_hdr && (vnet.flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM)))
+            buf->csum = BUF_CSUM_VALID;
+        buf->len = len;
+        return len;
+    }
+}
+
+/**
+ * @brief 从TAP网卡一次接收一批数据包
+ *        轮流读各个队列，直到取满n个或所有队列都读空
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数，错误为-1
+ */
+static int tap_driver_recv_batch(driver_t *drv, buf_t *bufs, int n)
+{
+    tap_dev_t *tap = drv->priv;
+    int i = 0, idle = 0;
+    while (i < n && idle < tap->queues)
+    {
+        int ret = tap_read(tap, tap->fds[tap->next], drv->mac, &bufs[i]);
+        if (ret < 0)
+            return i ? i : -1;
+        if (ret == 0)
+        {
+            idle++;
+            tap->next = (tap->next + 1) % tap->queues;
+            continue;
+        }
+        idle = 0;
+        i++;
+    }
+    return i;
+}
+
+/**
+ * @brief 从TAP网卡接收一个数据包
+ * 
+ * @param drv 网卡
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0，错误为-1
+ */
+static int tap_driver_recv(driver_t *drv, buf_t *buf)
+{
+    int ret = tap_driver_recv_batch(drv, buf, 1);
+    return ret > 0 ? buf->len : ret;
+}
+
+/**
+ * @brief 向TAP网卡写一帧
+ *        带virtio_net_hdr时在帧前加一个全0的头，表示校验和已填好、不需要分段
+ * 
+ * @param tap TAP网卡
+ * @param fd 队列的文件描述符
+ * @param iov 帧的各段
+ * @param iovcnt 段数
+ * @return int 成功为0，失败为-1
+ */
+static int tap_write(tap_dev_t *tap, int fd, const struct iovec *iov, int iovcnt)
+{
+    static struct virtio_net_hdr vnet;
+    struct iovec vec[iovcnt + 1];
+    vec[0] = (struct iovec){&vnet, sizeof(vnet)};
+    memcpy(vec + 1, iov, iovcnt * sizeof(struct iovec));
+    while (writev(fd, vec + !tap->vnet_hdr, iovcnt + tap->vnet_hdr) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        fprintf(stderr, "Error in driver_send: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 向TAP网卡发送一个数据包
+ * 
+ * @param drv 网卡
+ * @param buf 要发送的数据包
+ * @return int 成功为0，失败为-1
+ */
+static int tap_driver_send(driver_t *drv, buf_t *buf)
+{
+    tap_dev_t *tap = drv->priv;
+    struct iovec iov = {buf->data, buf->len};
+    return tap_write(tap, tap->fds[0], &iov, 1);
+}
+
+/**
+ * @brief 向TAP网卡发送一批帧
+ *        TAP一次writev()只能写一帧，在这里连续写完整批；都写到第一个队列，保持分片等帧的顺序
+ * 
+ * @param drv 网卡
+ * @param frames 要发送的帧，各段由writev()拼接
+ * @param n 帧的个数
+ * @return int 成功发送的帧数，错误为-1
+ */
+static int tap_driver_send_batch(driver_t *drv, driver_frame_t *frames, int n)
+{
+    tap_dev_t *tap = drv->priv;
+    for (int i = 0; i < n; i++)
+        if (tap_write(tap, tap->fds[0], frames[i].iov, frames[i].iovcnt) != 0)
+            return i ? i : -1;
+    return n;
+}
+
+/**
+ * @brief TAP网卡可供epoll等待的文件描述符，每个队列一个
+ * 
+ * @param drv 网卡
+ * @param fds 存放文件描述符的数组
+ * @param max 数组长度
+ * @return int 文件描述符个数
+ */
+static int tap_driver_fds(driver_t *drv, int *fds, int max)
+{
+    tap_dev_t *tap = drv->priv;
+    int n = tap->queues < max ? tap->queues : max;
+    memcpy(fds, tap->fds, n * sizeof(int));
+    return n;
+}
+
+/**
+ * @brief 生成过滤程序并以TUNATTACHFILTER装入TAP网卡，对所有队列生效，原子地替换原有的过滤程序
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int tap_driver_set_filter(driver_t *drv)
+{
+    tap_dev_t *tap = drv->priv;
+    struct sock_filter insns[DRIVER_FILTER_MAX_INSNS];
+    int n = driver_filter_build(drv, insns, DRIVER_FILTER_MAX_INSNS);
+    if (n < 0)
+        return -1;
+    struct sock_fprog fprog = {.len = n, .filter = insns};
+    if (ioctl(tap->fds[0], TUNATTACHFILTER, &fprog) < 0)
+    {
+        fprintf(stderr, "Error in ioctl(TUNATTACHFILTER): %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+const driver_ops_t driver_tap_ops = {
+    .name = "tap",
+    .open = tap_driver_open,
+    .recv = tap_driver_recv,
+    .recv_batch = tap_driver_recv_batch,
+    .send = tap_driver_send,
+    .send_batch = tap_driver_send_batch,
+    .close = tap_driver_close,
+    .fds = tap_driver_fds,
+    .set_filter = tap_driver_set_filter,
+};
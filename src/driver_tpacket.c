@@ -0,0 +1,408 @@
+#define _GNU_SOURCE //sendmmsg()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include "utils.h"
+#include "config.h"
+#include "driver.h"
+
+/**
+ * @brief TPACKET_V3后端的私有数据
+ *        内核把收到的帧按块(block)写入环形缓冲区，一个块退役(retire)后整块交给用户态，
+ *        用户态逐帧遍历该块，全部处理完后再把整块还给内核
+ * 
+ */
+typedef struct tpacket_ring
+{
+    int fd;                       //AF_PACKET套接字
+    int if_index;                 //网卡序号
+    uint8_t *map;                 //映射的环形缓冲区
+    size_t map_len;               //映射长度
+    struct tpacket_req3 req;      //环形缓冲区参数
+    unsigned int block;           //当前块号
+    struct tpacket_block_desc *desc; //当前正在遍历的块，为NULL表示没有
+    uint32_t left;                //当前块中剩余的帧数
+    struct tpacket3_hdr *frame;   //当前块中下一帧
+    unsigned int held;            //已遍历完但帧可能仍被协议栈引用、尚未还给内核的块数
+} tpacket_ring_t;
+
+/**
+ * @brief 当前块已遍历完，转到下一块
+ *        该块中的帧可能仍被零拷贝的数据包引用，先记为暂扣，由tpacket_release_held()还给内核
+ * 
+ * @param ring 环形缓冲区
+ */
+static void tpacket_block_done(tpacket_ring_t *ring)
+{
+    ring->held++;
+    ring->desc = NULL;
+    ring->block = (ring->block + 1) % ring->req.tp_block_nr;
+}
+
+/**
+ * @brief 把所有暂扣的块还给内核
+ * 
+ * @param ring 环形缓冲区
+ */
+static void tpacket_release_held(tpacket_ring_t *ring)
+{
+    unsigned int nr = ring->req.tp_block_nr;
+    unsigned int first = (ring->block + nr - ring->held) % nr;
+    __sync_synchronize();
+    for (unsigned int i = 0; i < ring->held; i++)
+    {
+        struct tpacket_block_desc *desc =
+            (struct tpacket_block_desc *)(ring->map + (size_t)((first + i) % nr) * ring->req.tp_block_size);
+        desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    }
+    ring->held = 0;
+}
+
+/**
+ * @brief 关闭TPACKET_V3网卡
+ * 
+ * @param drv 网卡
+ */
+static void tpacket_driver_close(driver_t *drv)
+{
+    tpacket_ring_t *ring = drv->priv;
+    if (ring == NULL)
+        return;
+    if (ring->map)
+        munmap(ring->map, ring->map_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    free(ring);
+    drv->priv = NULL;
+}
+
+/**
+ * @brief 以AF_PACKET TPACKET_V3环形缓冲区打开网卡
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int tpacket_driver_open(driver_t *drv)
+{
+    tpacket_ring_t *ring = calloc(1, sizeof(tpacket_ring_t));
+    if (ring == NULL)
+        return -1;
+    ring->fd = -1;
+    drv->priv = ring;
+
+    if ((ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+    {
+        fprintf(stderr, "Error in socket(AF_PACKET): %s\n", strerror(errno));
+        goto fail;
+    }
+    if ((ring->if_index = if_nametoindex(drv->if_name)) == 0)
+    {
+        fprintf(stderr, "Error in if_nametoindex(%s): %s\n", drv->if_name, strerror(errno));
+        goto fail;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        fprintf(stderr, "Error in setsockopt(PACKET_VERSION): %s\n", strerror(errno));
+        goto fail;
+    }
+
+    ring->req.tp_block_size = DRIVER_TPACKET_BLOCK_SIZE;
+    ring->req.tp_block_nr = DRIVER_TPACKET_BLOCK_NR;
+    ring->req.tp_frame_size = DRIVER_TPACKET_FRAME_SIZE;
+    ring->req.tp_frame_nr = DRIVER_TPACKET_BLOCK_SIZE / DRIVER_TPACKET_FRAME_SIZE * DRIVER_TPACKET_BLOCK_NR;
+    ring->req.tp_retire_blk_tov = DRIVER_TPACKET_RETIRE_MS; //块未写满时的退役超时
+    ring->req.tp_feature_req_word = 0;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &ring->req, sizeof(ring->req)) < 0)
+    {
+        fprintf(stderr, "Error in setsockopt(PACKET_RX_RING): %s\n", strerror(errno));
+        goto fail;
+    }
+
+    ring->map_len = (size_t)ring->req.tp_block_size * ring->req.tp_block_nr;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (ring->map == MAP_FAILED)
+    {
+        ring->map = NULL;
+        fprintf(stderr, "Error in mmap(PACKET_RX_RING): %s\n", strerror(errno));
+        goto fail;
+    }
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ring->if_index;
+    if (bind(ring->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+    {
+        fprintf(stderr, "Error in bind(%s): %s\n", drv->if_name, strerror(errno));
+        goto fail;
+    }
+
+    struct packet_mreq mreq; //混杂模式，与libpcap后端一致
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = ring->if_index;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+    {
+        fprintf(stderr, "Error in setsockopt(PACKET_ADD_MEMBERSHIP): %s\n", strerror(errno));
+        goto fail;
+    }
+    return 0;
+
+fail:
+    tpacket_driver_close(drv); //已打开的套接字与已映射的环形缓冲区一并释放
+    return -1;
+}
+
+/**
+ * @brief 取环形缓冲区中下一个要处理的帧
+ *        只处理发往本网卡与广播的数据帧，并跳过本机发出的帧，与libpcap后端的过滤规则一致；
+ *        帧头的tp_status即PACKET_AUXDATA中的tp_status：TP_STATUS_CSUM_VALID表示内核或网卡已校验传输层校验和，
+ *        TP_STATUS_CSUMNOTREADY表示本机发出、校验和留待网卡计算，两者都不必再由协议栈校验UDP，只涉及传输层
+ * 
+ * @param drv 网卡
+ * @param data 帧数据在环形缓冲区中的地址
+ * @param csum 帧的校验和结论
+ * @return uint32_t 帧长度，没有可处理的帧时为0
+ */
+static uint32_t tpacket_next_frame(driver_t *drv, uint8_t **data, uint8_t *csum)
+{
+    tpacket_ring_t *ring = drv->priv;
+    const uint8_t *if_mac = drv->mac;
+    static const uint8_t bc_mac[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+    for (;;)
+    {
+        if (ring->desc == NULL) //取下一个已退役的块
+        {
+            struct tpacket_block_desc *desc =
+                (struct tpacket_block_desc *)(ring->map + (size_t)ring->block * ring->req.tp_block_size);
+            if ((desc->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+                return 0;
+            __sync_synchronize();
+            ring->desc = desc;
+            ring->left = desc->hdr.bh1.num_pkts;
+            ring->frame = (struct tpacket3_hdr *)((uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt);
+        }
+        if (ring->left == 0)
+        {
+            tpacket_block_done(ring);
+            continue;
+        }
+
+        struct tpacket3_hdr *frame = ring->frame;
+        struct sockaddr_ll *sll = (struct sockaddr_ll *)((uint8_t *)frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        uint8_t *p = (uint8_t *)frame + frame->tp_mac;
+        uint32_t len = frame->tp_snaplen;
+        ring->frame = (struct tpacket3_hdr *)((uint8_t *)frame + frame->tp_next_offset);
+        ring->left--;
+
+        if (sll->sll_pkttype == PACKET_OUTGOING || len < 14 ||
+            (memcmp(p, if_mac, 6) && memcmp(p, bc_mac, 6)) ||
+            memcmp(p + 6, if_mac, 6) == 0)
+            continue;
+
+        *data = p;
+        *csum = drv->rx_csum_offload && (frame->tp_status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY))
+                    ? BUF_CSUM_VALID
+                    : BUF_CSUM_NONE;
+        return len;
+    }
+}
+
+/**
+ * @brief 从TPACKET_V3环形缓冲区接收数据包
+ * 
+ * @param drv 网卡
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0，错误为-1
+ */
+static int tpacket_driver_recv(driver_t *drv, buf_t *buf)
+{
+    uint8_t *data, csum;
+    uint32_t len = tpacket_next_frame(drv, &data, &csum);
+    if (len == 0)
+        return 0;
+    if (buf_init_frame(buf, len) < 0) //缓冲池用尽，丢弃
+        len = 0;
+    else
+    {
+        memcpy(buf->data, data, len);
+        buf->csum = csum;
+    }
+    tpacket_release_held(drv->priv);
+    return len;
+}
+
+/**
+ * @brief 从TPACKET_V3环形缓冲区一次接收一批数据包，连续遍历已退役的块直到取满n个或没有更多的帧
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int tpacket_driver_recv_batch(driver_t *drv, buf_t *bufs, int n)
+{
+    int i = 0;
+    while (i < n)
+    {
+        uint8_t *data, csum;
+        uint32_t len = tpacket_next_frame(drv, &data, &csum);
+        if (len == 0)
+            break;
+        if (buf_init_frame(&bufs[i], len) < 0) //缓冲池用尽，丢弃
+            continue;
+        memcpy(bufs[i].data, data, len);
+        bufs[i++].csum = csum;
+    }
+    tpacket_release_held(drv->priv);
+    return i;
+}
+
+/**
+ * @brief 从TPACKET_V3环形缓冲区零拷贝接收一批数据包
+ *        数据包直接指向环形缓冲区中的帧，帧所在的块在tpacket_driver_release()之前不会还给内核
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组，只填写len、data与csum
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int tpacket_driver_recv_zc(driver_t *drv, buf_t *bufs, int n)
+{
+    int i = 0;
+    for (; i < n; i++)
+    {
+        uint32_t len = tpacket_next_frame(drv, &bufs[i].data, &bufs[i].csum);
+        if (len == 0)
+            break;
+        bufs[i].len = len;
+    }
+    return i;
+}
+
+/**
+ * @brief 协议栈已处理完零拷贝收到的数据包，把遍历完的块还给内核
+ * 
+ * @param drv 网卡
+ */
+static void tpacket_driver_release(driver_t *drv)
+{
+    tpacket_release_held(drv->priv);
+}
+
+/**
+ * @brief 通过AF_PACKET套接字发送一个数据包
+ * 
+ * @param drv 网卡
+ * @param buf 要发送的数据包
+ * @return int 成功为0，失败为-1
+ */
+static int tpacket_driver_send(driver_t *drv, buf_t *buf)
+{
+    tpacket_ring_t *ring = drv->priv;
+    if (send(ring->fd, buf->data, buf->len, 0) < 0)
+    {
+        fprintf(stderr, "Error in driver_send: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 通过sendmmsg()一次系统调用发送一批帧
+ * 
+ * @param drv 网卡
+ * @param frames 要发送的帧，各段由内核拼接
+ * @param n 帧的个数
+ * @return int 成功发送的帧数，错误为-1
+ */
+static int tpacket_driver_send_batch(driver_t *drv, driver_frame_t *frames, int n)
+{
+    tpacket_ring_t *ring = drv->priv;
+    struct mmsghdr msgs[n];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < n; i++)
+    {
+        msgs[i].msg_hdr.msg_iov = frames[i].iov;
+        msgs[i].msg_hdr.msg_iovlen = frames[i].iovcnt;
+    }
+
+    int sent = 0;
+    while (sent < n)
+    {
+        int ret = sendmmsg(ring->fd, msgs + sent, n - sent, 0);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Error in driver_send_batch: %s\n", strerror(errno));
+            return sent ? sent : -1;
+        }
+        sent += ret;
+    }
+    return sent;
+}
+
+/**
+ * @brief TPACKET_V3网卡可供epoll等待的文件描述符，有块退役时可读
+ * 
+ * @param drv 网卡
+ * @param fds 存放文件描述符的数组
+ * @param max 数组长度
+ * @return int 文件描述符个数
+ */
+static int tpacket_driver_fds(driver_t *drv, int *fds, int max)
+{
+    tpacket_ring_t *ring = drv->priv;
+    if (max < 1)
+        return 0;
+    fds[0] = ring->fd;
+    return 1;
+}
+
+/**
+ * @brief 生成过滤程序并以SO_ATTACH_FILTER装入AF_PACKET套接字，内核原子地替换原有的过滤程序
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int tpacket_driver_set_filter(driver_t *drv)
+{
+    tpacket_ring_t *ring = drv->priv;
+    struct sock_filter insns[DRIVER_FILTER_MAX_INSNS];
+    int n = driver_filter_build(drv, insns, DRIVER_FILTER_MAX_INSNS);
+    if (n < 0)
+        return -1;
+    struct sock_fprog fprog = {.len = n, .filter = insns};
+    if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+    {
+        fprintf(stderr, "Error in setsockopt(SO_ATTACH_FILTER): %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+const driver_ops_t driver_tpacket_ops = {
+    .name = "tpacket",
+    .open = tpacket_driver_open,
+    .recv = tpacket_driver_recv,
+    .recv_batch = tpacket_driver_recv_batch,
+    .recv_zc = tpacket_driver_recv_zc,
+    .release = tpacket_driver_release,
+    .send = tpacket_driver_send,
+    .send_batch = tpacket_driver_send_batch,
+    .close = tpacket_driver_close,
+    .fds = tpacket_driver_fds,
+    .set_filter = tpacket_driver_set_filter,
+};
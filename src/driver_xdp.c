@@ -0,0 +1,618 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/if_packet.h>
+#include <linux/bpf.h>
+#include "utils.h"
+#include "config.h"
+#include "driver.h"
+
+/**
+ * @brief AF_XDP的一个环形队列（填充、完成、接收或发送队列）
+ *        生产者与消费者下标都只增不减，取模后定位到描述符
+ * 
+ */
+typedef struct xsk_ring
+{
+    uint32_t *producer; //生产者下标
+    uint32_t *consumer; //消费者下标
+    uint32_t *flags;    //队列标志，如XDP_RING_NEED_WAKEUP
+    void *desc;         //描述符数组
+    uint32_t size;      //描述符个数，2的幂
+    void *map;          //映射的内存
+    size_t map_len;     //映射长度
+} xsk_ring_t;
+
+/**
+ * @brief AF_XDP后端的私有数据
+ *        收发的帧都在UMEM中：填充队列把空闲帧交给内核接收，接收队列交回收到的帧；
+ *        发送队列把帧交给内核发送，完成队列交回已发送的帧
+ * 
+ */
+typedef struct xsk
+{
+    int fd;                 //AF_XDP套接字
+    int if_index;           //网卡序号
+    int map_fd;             //XSKMAP，XDP程序按接收队列号把帧重定向到套接字
+    int prog_fd;            //XDP程序
+    int link_fd;            //XDP程序与网卡的链接，关闭时自动卸载程序
+    int promisc_fd;         //只用来保持混杂模式的AF_PACKET套接字
+    int zero_copy;          //是否工作在零拷贝模式
+    uint8_t *umem;          //UMEM内存
+    size_t umem_len;        //UMEM长度
+    xsk_ring_t fill;        //填充队列
+    xsk_ring_t comp;        //完成队列
+    xsk_ring_t rx;          //接收队列
+    xsk_ring_t tx;          //发送队列
+    uint64_t held[DRIVER_XDP_RING_SIZE]; //零拷贝交给协议栈、尚未还给填充队列的帧
+    uint32_t held_nr;       //held中的帧数
+    uint64_t free[DRIVER_XDP_FRAME_NR]; //可用于发送的空闲帧
+    uint32_t free_nr;       //free中的帧数
+} xsk_t;
+
+#define XSK_INSN(c, d, s, o, i) ((struct bpf_insn){.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i)})
+
+/**
+ * @brief bpf()系统调用，glibc没有提供封装
+ * 
+ * @param cmd 命令，如BPF_PROG_LOAD
+ * @param attr 命令参数
+ * @return int 成功时为非负数（多为文件描述符），失败为-1
+ */
+static int xsk_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * @brief 由协议栈当前状态生成并加载XDP程序
+ *        目的mac为本网卡或广播的帧属于协议栈：DRIVER_KERNEL_FILTER为1时只把ARP，以及目的ip为本机的ICMP、
+ *        非首个分片、目的端口已打开的UDP重定向到本接收队列的AF_XDP套接字，其余的直接丢弃；
+ *        不是发给协议栈的帧交给内核协议栈。没有libbpf，程序直接以指令写出，等价于：
+ *            if (data + 34 > data_end) return XDP_PASS;
+ *            if (dst != mac && dst != broadcast) return XDP_PASS;
+ *            if (type == ARP) goto redirect;
+ *            if (type != IP || dest_ip != ip) return XDP_DROP;
+ *            if (protocol == ICMP || (protocol == UDP && (frag_off || dest_port in ports))) goto redirect;
+ *            return XDP_DROP;
+ *        redirect:
+ *            return bpf_redirect_map(&xsks, rx_queue_index, XDP_PASS);
+ * 
+ * @param drv 网卡，使用其中的mac、ip与已打开的udp端口
+ * @param map_fd XSKMAP
+ * @return int 程序的文件描述符，失败为-1
+ */
+static int xsk_load_prog(const driver_t *drv, int map_fd)
+{
+    uint32_t mac03, ip;
+    uint16_t mac45;
+    memcpy(&mac03, drv->mac, 4); //与程序中的内存读取字节序一致
+    memcpy(&mac45, drv->mac + 4, 2);
+    memcpy(&ip, drv->ip, 4);
+
+    struct bpf_insn prog[40 + UDP_MAX_HANDLER];
+    int ours = 12;
+#if DRIVER_KERNEL_FILTER
+    int drop = ours + 18 + drv->udp_port_nr, redirect = drop + 2;
+#else
+    int redirect = ours + 1;
+#endif
+    int pass = redirect + 6;
+    int n = 0;
+
+#define TO(label) ((label) - n - 1) //从第n条指令跳到label的偏移
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0), n++;
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 34), n++; //以太网头+IP头
+    prog[n] = XSK_INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, TO(pass), 0), n++;
+    //目的mac为本网卡或广播
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_4, BPF_REG_2, 0, 0), n++;
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 4, 0), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, 2, mac03), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, 1, mac45), n++;
+    prog[n] = XSK_INSN(BPF_JMP | BPF_JA, 0, 0, TO(ours), 0), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, TO(pass), -1), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, TO(pass), 0xFFFF), n++;
+#if DRIVER_KERNEL_FILTER
+    //类型、目的ip、协议
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, 12, 0), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JEQ | BPF_K, BPF_REG_4, 0, TO(redirect), htons(0x0806)), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, TO(drop), htons(0x0800)), n++;
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_4, BPF_REG_2, 30, 0), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, TO(drop), ip), n++;
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_4, BPF_REG_2, 23, 0), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JEQ | BPF_K, BPF_REG_4, 0, TO(redirect), 1), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_4, 0, TO(drop), 17), n++;
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, 20, 0), n++;
+    prog[n] = XSK_INSN(BPF_JMP32 | BPF_JSET | BPF_K, BPF_REG_4, 0, TO(redirect), htons(0x1FFF)), n++;
+    //UDP目的端口，IP头长度可变
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, 14, 0), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, 0xF), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_5, 0, 0, 2), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_2, BPF_REG_5, 0, 0), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 18), n++;
+    prog[n] = XSK_INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, TO(drop), 0), n++;
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, 16, 0), n++;
+    for (int i = 0; i < drv->udp_port_nr; i++)
+        prog[n] = XSK_INSN(BPF_JMP32 | BPF_JEQ | BPF_K, BPF_REG_4, 0, TO(redirect), htons(drv->udp_ports[i])), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_DROP), n++; //drop
+    prog[n] = XSK_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0), n++;
+#else
+    prog[n] = XSK_INSN(BPF_JMP | BPF_JA, 0, 0, TO(redirect), 0), n++;
+#endif
+#undef TO
+    prog[n] = XSK_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index), 0), n++; //redirect
+    prog[n] = XSK_INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd), n++;
+    prog[n] = XSK_INSN(0, 0, 0, 0, 0), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS), n++; //套接字不存在时pass
+    prog[n] = XSK_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map), n++;
+    prog[n] = XSK_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0), n++;
+    prog[n] = XSK_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS), n++; //pass
+    prog[n] = XSK_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0), n++;
+    static char log[4096];
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insns = (uintptr_t)prog;
+    attr.insn_cnt = n;
+    attr.license = (uintptr_t) "GPL";
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    int fd = xsk_bpf(BPF_PROG_LOAD, &attr);
+    if (fd < 0)
+        fprintf(stderr, "Error in bpf(BPF_PROG_LOAD): %s\n%s", strerror(errno), log);
+    return fd;
+}
+
+/**
+ * @brief 映射一个环形队列
+ * 
+ * @param ring 环形队列
+ * @param fd AF_XDP套接字
+ * @param off 该队列在映射中的各字段偏移
+ * @param pgoff 该队列的映射偏移，如XDP_PGOFF_RX_RING
+ * @param desc_size 描述符大小
+ * @return int 成功为0，失败为-1
+ */
+static int xsk_ring_map(xsk_ring_t *ring, int fd, const struct xdp_ring_offset *off, off_t pgoff, size_t desc_size)
+{
+    ring->size = DRIVER_XDP_RING_SIZE;
+    ring->map_len = off->desc + ring->size * desc_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (ring->map == MAP_FAILED)
+    {
+        ring->map = NULL;
+        fprintf(stderr, "Error in mmap(AF_XDP ring): %s\n", strerror(errno));
+        return -1;
+    }
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+    ring->flags = (uint32_t *)((uint8_t *)ring->map + off->flags);
+    ring->desc = (uint8_t *)ring->map + off->desc;
+    return 0;
+}
+
+/**
+ * @brief 把帧交给填充队列，供内核接收
+ * 
+ * @param xsk 私有数据
+ * @param addrs 帧在UMEM中的地址
+ * @param n 帧数，调用者保证填充队列有足够空间（在途的接收帧数不超过队列长度）
+ */
+static void xsk_fill(xsk_t *xsk, const uint64_t *addrs, uint32_t n)
+{
+    uint32_t prod = *xsk->fill.producer;
+    uint64_t *desc = xsk->fill.desc;
+    for (uint32_t i = 0; i < n; i++)
+        desc[(prod + i) & (xsk->fill.size - 1)] = addrs[i] & ~(uint64_t)(DRIVER_XDP_FRAME_SIZE - 1);
+    __atomic_store_n(xsk->fill.producer, prod + n, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 从完成队列回收已发送完的帧
+ * 
+ * @param xsk 私有数据
+ */
+static void xsk_reclaim(xsk_t *xsk)
+{
+    uint32_t cons = *xsk->comp.consumer;
+    uint32_t n = __atomic_load_n(xsk->comp.producer, __ATOMIC_ACQUIRE) - cons;
+    uint64_t *desc = xsk->comp.desc;
+    for (uint32_t i = 0; i < n; i++)
+        xsk->free[xsk->free_nr++] = desc[(cons + i) & (xsk->comp.size - 1)];
+    __atomic_store_n(xsk->comp.consumer, cons + n, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 以AF_XDP套接字打开网卡
+ *        配置为零拷贝时先尝试驱动模式+零拷贝，网卡驱动不支持时退回通用(SKB)模式+拷贝，
+ *        通用模式可以在veth等任意网卡上使用
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int xdp_driver_open(driver_t *drv)
+{
+    xsk_t *xsk = calloc(1, sizeof(xsk_t));
+    if (xsk == NULL)
+        return -1;
+    xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = xsk->promisc_fd = -1;
+    drv->priv = xsk;
+
+    if ((xsk->if_index = if_nametoindex(drv->if_name)) == 0)
+    {
+        fprintf(stderr, "Error in if_nametoindex(%s): %s\n", drv->if_name, strerror(errno));
+        return -1;
+    }
+    if ((xsk->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0)
+    {
+        fprintf(stderr, "Error in socket(AF_XDP): %s\n", strerror(errno));
+        return -1;
+    }
+
+    xsk->umem_len = (size_t)DRIVER_XDP_FRAME_NR * DRIVER_XDP_FRAME_SIZE;
+    if (drv->xdp_umem == NULL) //UMEM放在包内存区中，由大页支撑，不能释放，关闭后留给同一网卡再次打开时使用
+        drv->xdp_umem = net_mem_alloc(xsk->umem_len);
+    xsk->umem = drv->xdp_umem;
+    if (xsk->umem == NULL)
+    {
+        fprintf(stderr, "Error in allocating UMEM: %s\n", strerror(errno));
+        return -1;
+    }
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t)xsk->umem;
+    reg.len = xsk->umem_len;
+    reg.chunk_size = DRIVER_XDP_FRAME_SIZE;
+    reg.headroom = NET_IP_ALIGN; //内核在帧前的XDP余量之后再留出的字节数，使零拷贝接收的IP头自然对齐
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+    {
+        fprintf(stderr, "Error in setsockopt(XDP_UMEM_REG): %s\n", strerror(errno));
+        return -1;
+    }
+
+    int size = DRIVER_XDP_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0)
+    {
+        fprintf(stderr, "Error in setsockopt(AF_XDP rings): %s\n", strerror(errno));
+        return -1;
+    }
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+    {
+        fprintf(stderr, "Error in getsockopt(XDP_MMAP_OFFSETS): %s\n", strerror(errno));
+        return -1;
+    }
+    if (xsk_ring_map(&xsk->fill, xsk->fd, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+        xsk_ring_map(&xsk->comp, xsk->fd, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)) ||
+        xsk_ring_map(&xsk->rx, xsk->fd, &off.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc)) ||
+        xsk_ring_map(&xsk->tx, xsk->fd, &off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc)))
+        return -1;
+
+    //前一半帧交给内核接收，后一半留作发送
+    uint64_t addrs[DRIVER_XDP_RING_SIZE];
+    uint32_t rx_frames = DRIVER_XDP_FRAME_NR / 2 < DRIVER_XDP_RING_SIZE ? DRIVER_XDP_FRAME_NR / 2 : DRIVER_XDP_RING_SIZE;
+    for (uint32_t i = 0; i < rx_frames; i++)
+        addrs[i] = (uint64_t)i * DRIVER_XDP_FRAME_SIZE;
+    xsk_fill(xsk, addrs, rx_frames);
+    for (uint32_t i = rx_frames; i < DRIVER_XDP_FRAME_NR; i++)
+        xsk->free[xsk->free_nr++] = (uint64_t)i * DRIVER_XDP_FRAME_SIZE;
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xsk->if_index;
+    sxdp.sxdp_queue_id = DRIVER_XDP_QUEUE;
+    sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    xsk->zero_copy = DRIVER_XDP_ZERO_COPY && bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0;
+    if (!xsk->zero_copy)
+    {
+        if (DRIVER_XDP_ZERO_COPY)
+            fprintf(stderr, "Warning: %s does not support AF_XDP zero-copy (%s), using copy mode\n", drv->if_name, strerror(errno));
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+        {
+            fprintf(stderr, "Error in bind(AF_XDP, %s): %s\n", drv->if_name, strerror(errno));
+            return -1;
+        }
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(int);
+    attr.max_entries = DRIVER_XDP_QUEUE + 1;
+    if ((xsk->map_fd = xsk_bpf(BPF_MAP_CREATE, &attr)) < 0)
+    {
+        fprintf(stderr, "Error in bpf(BPF_MAP_CREATE): %s\n", strerror(errno));
+        return -1;
+    }
+    uint32_t key = DRIVER_XDP_QUEUE;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xsk->map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&xsk->fd;
+    if (xsk_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+    {
+        fprintf(stderr, "Error in bpf(BPF_MAP_UPDATE_ELEM): %s\n", strerror(errno));
+        return -1;
+    }
+    //XDP程序由driver_open()调用xdp_driver_set_filter()生成并挂载
+
+    //混杂模式，与其它后端一致；套接字关闭时内核自动撤销
+    struct packet_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = xsk->if_index;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if ((xsk->promisc_fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0 ||
+        setsockopt(xsk->promisc_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        fprintf(stderr, "Warning: failed to set %s promiscuous: %s\n", drv->if_name, strerror(errno));
+
+    fprintf(stderr, "AF_XDP on %s queue %d: %s mode\n", drv->if_name, DRIVER_XDP_QUEUE,
+            xsk->zero_copy ? "zero-copy" : "copy");
+    return 0;
+}
+
+/**
+ * @brief 从接收队列零拷贝取一批帧
+ *        数据包直接指向UMEM中的帧，帧在xdp_driver_release()还给填充队列之前不会被内核改写
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组，只填写len与data
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int xdp_driver_recv_zc(driver_t *drv, buf_t *bufs, int n)
+{
+    xsk_t *xsk = drv->priv;
+    uint32_t cons = *xsk->rx.consumer;
+    uint32_t avail = __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE) - cons;
+    if (avail == 0)
+    {
+        if (__atomic_load_n(xsk->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+            recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        return 0;
+    }
+    if (avail > (uint32_t)n)
+        avail = n;
+
+    struct xdp_desc *desc = xsk->rx.desc;
+    for (uint32_t i = 0; i < avail; i++)
+    {
+        struct xdp_desc *d = &desc[(cons + i) & (xsk->rx.size - 1)];
+        bufs[i].data = xsk->umem + d->addr;
+        bufs[i].len = d->len;
+        xsk->held[xsk->held_nr++] = d->addr;
+    }
+    __atomic_store_n(xsk->rx.consumer, cons + avail, __ATOMIC_RELEASE);
+    return avail;
+}
+
+/**
+ * @brief 协议栈已处理完零拷贝收到的数据包，把帧还给填充队列
+ * 
+ * @param drv 网卡
+ */
+static void xdp_driver_release(driver_t *drv)
+{
+    xsk_t *xsk = drv->priv;
+    xsk_fill(xsk, xsk->held, xsk->held_nr);
+    xsk->held_nr = 0;
+}
+
+/**
+ * @brief 从接收队列拷贝取一批帧
+ * 
+ * @param drv 网卡
+ * @param bufs 存放收到的数据包的数组
+ * @param n 最多接收的数据包个数
+ * @return int 收到的数据包个数
+ */
+static int xdp_driver_recv_batch(driver_t *drv, buf_t *bufs, int n)
+{
+    n = xdp_driver_recv_zc(drv, bufs, n);
+    int got = 0;
+    for (int i = 0; i < n; i++)
+    {
+        uint8_t *data = bufs[i].data;
+        uint16_t len = bufs[i].len;
+        if (buf_init_frame(&bufs[got], len) < 0) //缓冲池用尽，丢弃
+            continue;
+        memcpy(bufs[got++].data, data, len);
+    }
+    xdp_driver_release(drv);
+    return got;
+}
+
+/**
+ * @brief 从接收队列拷贝取一帧
+ * 
+ * @param drv 网卡
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int xdp_driver_recv(driver_t *drv, buf_t *buf)
+{
+    return xdp_driver_recv_batch(drv, buf, 1) ? buf->len : 0;
+}
+
+/**
+ * @brief 把一批帧拷贝进UMEM并放入发送队列，再通知内核发送
+ * 
+ * @param drv 网卡
+ * @param frames 要发送的帧，各段依次拷贝进同一个UMEM帧
+ * @param n 帧的个数
+ * @return int 成功放入发送队列的帧数，错误为-1
+ */
+static int xdp_driver_send_batch(driver_t *drv, driver_frame_t *frames, int n)
+{
+    xsk_t *xsk = drv->priv;
+    uint32_t prod = *xsk->tx.producer;
+    uint32_t space = xsk->tx.size - (prod - __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE));
+    struct xdp_desc *desc = xsk->tx.desc;
+
+    xsk_reclaim(xsk);
+    int i = 0;
+    for (; i < n && (uint32_t)i < space && xsk->free_nr > 0; i++)
+    {
+        if (frames[i].len > DRIVER_XDP_FRAME_SIZE)
+        {
+            fprintf(stderr, "Error in driver_send: frame of %u bytes exceeds UMEM frame\n", frames[i].len);
+            break;
+        }
+        struct xdp_desc *d = &desc[(prod + i) & (xsk->tx.size - 1)];
+        d->addr = xsk->free[--xsk->free_nr];
+        d->len = frames[i].len;
+        d->options = 0;
+        uint8_t *p = xsk->umem + d->addr;
+        for (int j = 0; j < frames[i].iovcnt; j++)
+        {
+            memcpy(p, frames[i].iov[j].iov_base, frames[i].iov[j].iov_len);
+            p += frames[i].iov[j].iov_len;
+        }
+    }
+    __atomic_store_n(xsk->tx.producer, prod + i, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(xsk->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+        if (sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+            errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+        {
+            fprintf(stderr, "Error in driver_send_batch: %s\n", strerror(errno));
+            return i ? i : -1;
+        }
+    return i ? i : (n ? -1 : 0);
+}
+
+/**
+ * @brief 发送一个数据包
+ * 
+ * @param drv 网卡
+ * @param buf 要发送的数据包
+ * @return int 成功为0，失败为-1
+ */
+static int xdp_driver_send(driver_t *drv, buf_t *buf)
+{
+    struct iovec iov = {.iov_base = buf->data, .iov_len = buf->len};
+    driver_frame_t frame = {&iov, 1, buf->len};
+    return xdp_driver_send_batch(drv, &frame, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief 关闭AF_XDP网卡，卸载XDP程序，解除各环形队列的映射并关闭套接字
+ *        UMEM从包内存区分配、不能释放，保留在drv->xdp_umem中供再次打开时使用
+ * 
+ * @param drv 网卡
+ */
+static void xdp_driver_close(driver_t *drv)
+{
+    xsk_t *xsk = drv->priv;
+    if (xsk == NULL)
+        return;
+    int fds[] = {xsk->link_fd, xsk->prog_fd, xsk->map_fd, xsk->promisc_fd, xsk->fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    xsk_ring_t *rings[] = {&xsk->fill, &xsk->comp, &xsk->rx, &xsk->tx};
+    for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+        if (rings[i]->map)
+            munmap(rings[i]->map, rings[i]->map_len);
+    free(xsk);
+    drv->priv = NULL;
+}
+
+/**
+ * @brief AF_XDP网卡可供epoll等待的文件描述符
+ * 
+ * @param drv 网卡
+ * @param fds 存放文件描述符的数组
+ * @param max 数组长度
+ * @return int 文件描述符个数
+ */
+static int xdp_driver_fds(driver_t *drv, int *fds, int max)
+{
+    xsk_t *xsk = drv->priv;
+    if (max < 1)
+        return 0;
+    fds[0] = xsk->fd;
+    return 1;
+}
+
+/**
+ * @brief 生成XDP程序并挂载到网卡，已挂载时以BPF_LINK_UPDATE原子地替换
+ *        零拷贝需要驱动模式的XDP，拷贝模式使用通用模式
+ * 
+ * @param drv 网卡
+ * @return int 成功为0，失败为-1
+ */
+static int xdp_driver_set_filter(driver_t *drv)
+{
+    xsk_t *xsk = drv->priv;
+    int prog_fd = xsk_load_prog(drv, xsk->map_fd);
+    if (prog_fd < 0)
+        return -1;
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    if (xsk->link_fd < 0)
+    {
+        attr.link_create.prog_fd = prog_fd;
+        attr.link_create.target_ifindex = xsk->if_index;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = xsk->zero_copy ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+        if ((xsk->link_fd = xsk_bpf(BPF_LINK_CREATE, &attr)) < 0)
+        {
+            fprintf(stderr, "Error in bpf(BPF_LINK_CREATE, %s): %s\n", drv->if_name, strerror(errno));
+            close(prog_fd);
+            return -1;
+        }
+    }
+    else
+    {
+        attr.link_update.link_fd = xsk->link_fd;
+        attr.link_update.new_prog_fd = prog_fd;
+        if (xsk_bpf(BPF_LINK_UPDATE, &attr) < 0)
+        {
+            fprintf(stderr, "Error in bpf(BPF_LINK_UPDATE, %s): %s\n", drv->if_name, strerror(errno));
+            close(prog_fd);
+            return -1;
+        }
+    }
+    if (xsk->prog_fd >= 0)
+        close(xsk->prog_fd);
+    xsk->prog_fd = prog_fd;
+    return 0;
+}
+
+const driver_ops_t driver_xdp_ops = {
+    .name = "xdp",
+    .open = xdp_driver_open,
+    .recv = xdp_driver_recv,
+    .recv_batch = xdp_driver_recv_batch,
+    .recv_zc = xdp_driver_recv_zc,
+    .release = xdp_driver_release,
+    .send = xdp_driver_send,
+    .send_batch = xdp_driver_send_batch,
+    .close = xdp_driver_close,
+    .fds = xdp_driver_fds,
+    .set_filter = xdp_driver_set_filter,
+};
@@ -6,11 +6,30 @@
 #include <string.h>
 #include <stdio.h>
 
+/**
+ * @brief 突发接收使用的数据包数组
+ * 
+ */
+static buf_t rx_burst[ETHERNET_BURST_MAX];
+
+/**
+ * @brief 每次以太网轮询最多处理的数据包数
+ * 
+ */
+static int ethernet_burst = ETHERNET_BURST;
+
+/**
+ * @brief 是否以向量方式处理一批数据包
+ * 
+ */
+static int ethernet_vector = ETHERNET_VECTOR;
+
 /**
  * @brief 处理一个收到的数据包
  *        你需要判断以太网数据帧的协议类型，注意大小端转换
  *        如果是ARP协议数据包，则去掉以太网包头，发送到arp层处理arp_in()
  *        如果是IP协议数据包，则去掉以太网包头，发送到IP层处理ip_in()
+ *        开启ETHERNET_EARLY_DEMUX时，IP数据包先交给ip_early_demux()，不满足快速路径条件时才由ip_in()逐层处理
  * 
  * @param buf 要处理的数据包
  */
@@ -20,6 +39,10 @@ void ethernet_in(buf_t *buf)
     
     if (buf->data[12] == 0x08 && buf->data[13] == 0x00){ //IP
         buf_remove_header(buf,14);
+#if ETHERNET_EARLY_DEMUX
+        if (ip_early_demux(buf)) //常见的UDP数据包直接交给处理程序
+            return;
+#endif
         ip_in(buf);
     }
     else if (buf->data[12]==0x08 && buf->data[13]==0x06){ //ARP
@@ -42,27 +65,33 @@ void ethernet_in(buf_t *buf)
 void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
 {
     // TODO
-    buf_add_header(buf,14);
-    buf->data[0] = mac[0];
-    buf->data[1] = mac[1];
-    buf->data[2] = mac[2];
-    buf->data[3] = mac[3];
-    buf->data[4] = mac[4];
-    buf->data[5] = mac[5];
-
-    buf->data[6] = 0x11;
-    buf->data[7] = 0x22;
-    buf->data[8] = 0x33;
-    buf->data[9] = 0x44;
-    buf->data[10] = 0x55;
-    buf->data[11] = 0x66;
-
-    buf->data[12] = protocol / 0x100;
-    buf->data[13] = protocol & 0x00ff;
+    if (buf_add_header(buf,sizeof(ether_hdr_t)) < 0) //写时复制时缓冲池用尽，丢弃
+        return;
+    ether_hdr_t *hdr = (ether_hdr_t *)buf->data;
+    memcpy(hdr->dest, mac, NET_MAC_LEN);
+    memcpy(hdr->src, net_if_mac, NET_MAC_LEN); //源mac为当前网络接口的mac地址
+    hdr->protocol = swap16(protocol);
     
     driver_send(buf);
 }
 
+/**
+ * @brief 用预先构造好的以太网头发送一个数据包
+ *        14字节的头按整体拷贝，编译为两次重叠的8字节读写，没有函数调用。
+ *        不补成16字节一次写入：往后多写的2字节是IP头，往前多写则要求帧前有2字节可写，
+ *        零拷贝接收的帧（如AF_XDP只留出NET_IP_ALIGN的余量）不能保证
+ * 
+ * @param buf 要处理的数据包
+ * @param hdr 以太网头
+ */
+void ethernet_out_hdr(buf_t *buf, const ether_hdr_t *hdr)
+{
+    if (buf_add_header(buf, sizeof(ether_hdr_t)) < 0) //写时复制时缓冲池用尽，丢弃
+        return;
+    memcpy(buf->data, hdr, sizeof(ether_hdr_t));
+    driver_send(buf);
+}
+
 /**
  * @brief 初始化以太网协议
  * 
@@ -70,16 +99,127 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
  */
 int ethernet_init()
 {
-    buf_init(&rxbuf, ETHERNET_MTU + sizeof(ether_hdr_t));
     return driver_open();
 }
 
 /**
- * @brief 一次以太网轮询
+ * @brief 设置每次以太网轮询最多处理的数据包数
+ * 
+ * @param burst 突发大小，取值范围为1到ETHERNET_BURST_MAX
+ */
+void ethernet_set_burst(int burst)
+{
+    if (burst < 1)
+        burst = 1;
+    if (burst > ETHERNET_BURST_MAX)
+        burst = ETHERNET_BURST_MAX;
+    ethernet_burst = burst;
+}
+
+/**
+ * @brief 设置是否以向量方式处理收到的数据包
+ * 
+ * @param on 为1时整批数据包依次经过各层，为0时逐个经过ethernet_in()
+ */
+void ethernet_set_vector(int on)
+{
+    ethernet_vector = on;
+}
+
+/**
+ * @brief 以向量方式处理一批收到的数据包（ethernet-input节点）
+ *        按协议类型把数据包无分支地分到ARP与IP两个向量，
+ *        去掉以太网头后整批交给arp_in_vec()与ip_in_vec()；
+ *        ARP向量先处理，同一批中的IP数据包因此能用上刚学到的邻居。
+ *        同一向量内保持收包顺序，不同向量之间不保持
+ * 
+ * @param bufs 收到的数据包
+ * @param n 数据包个数
+ */
+static void ethernet_in_vector(buf_t *bufs, int n)
+{
+    buf_t *ip_bufs[ETHERNET_BURST_MAX], *arp_bufs[ETHERNET_BURST_MAX];
+    int n_ip = 0, n_arp = 0;
+    for (int i = 0; i < n; i++)
+    {
+        __builtin_prefetch(bufs[i].data + 41); //IP头与UDP头可能跨入下一个缓存行，留给后面的节点
+        uint16_t protocol;
+        memcpy(&protocol, bufs[i].data + 12, sizeof(protocol));
+        int is_ip = protocol == swap16(NET_PROTOCOL_IP), is_arp = protocol == swap16(NET_PROTOCOL_ARP);
+        ip_bufs[n_ip] = arp_bufs[n_arp] = &bufs[i];
+        n_ip += is_ip;
+        n_arp += is_arp;
+        if (is_ip | is_arp)
+            buf_remove_header(&bufs[i], sizeof(ether_hdr_t));
+    }
+    if (n_arp)
+        arp_in_vec(arp_bufs, n_arp);
+    if (n_ip)
+        ip_in_vec(ip_bufs, n_ip);
+}
+
+/**
+ * @brief 处理一批收到的数据包
+ *        向量方式下交给ethernet_in_vector()；否则逐个处理，处理当前数据包时预取下一个数据包的以太网头和IP头
+ * 
+ * @param bufs 收到的数据包
+ * @param n 数据包个数
+ */
+static void ethernet_in_burst(buf_t *bufs, int n)
+{
+    if (ethernet_vector)
+    {
+        ethernet_in_vector(bufs, n);
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (i + 1 < n) //以太网头+IP头+UDP头共42字节，可能跨越两个缓存行
+        {
+            __builtin_prefetch(bufs[i + 1].data);
+            __builtin_prefetch(bufs[i + 1].data + 41);
+        }
+        ethernet_in(&bufs[i]);
+    }
+}
+
+/**
+ * @brief 一次以太网突发轮询
+ *        零拷贝模式下数据包直接引用驱动的帧内存，处理完一批即归还给驱动；
+ *        后端一次交出的数据包可能少于burst（如libpcap一次只能交出一个），此时继续收直到凑满或收不到
+ * 
+ * @param burst 最多处理的数据包个数，不超过ETHERNET_BURST_MAX
+ * @return int 本次处理的数据包个数
+ */
+int ethernet_poll_burst(int burst)
+{
+    if (burst > ETHERNET_BURST_MAX)
+        burst = ETHERNET_BURST_MAX;
+#if ETHERNET_ZERO_COPY
+    int total = 0;
+    while (total < burst)
+    {
+        int n = driver_recv_zc(rx_burst, burst - total);
+        if (n <= 0)
+            break;
+        ethernet_in_burst(rx_burst, n);
+        driver_release();
+        total += n;
+    }
+    return total;
+#else
+    int n = driver_recv_batch(rx_burst, burst);
+    ethernet_in_burst(rx_burst, n);
+    return n > 0 ? n : 0;
+#endif
+}
+
+/**
+ * @brief 一次以太网轮询，按当前设置的突发大小批量收包处理
  * 
+ * @return int 本次处理的数据包个数
  */
-void ethernet_poll()
+int ethernet_poll()
 {
-    if (driver_recv(&rxbuf) > 0)
-        ethernet_in(&rxbuf);
+    return ethernet_poll_burst(ethernet_burst);
 }
@@ -10,8 +10,7 @@
  *        如果是，则回送一个回显应答（ping应答），需要自行封装应答包。
  * 
  *        应答包封装如下：
- *        首先调用buf_init()函数初始化txbuf，然后封装报头和数据，
- *        数据部分可以拷贝来自接收到的回显请求报文中的数据。
+ *        回显应答的数据与请求相同，直接在收到的数据包上改写类型并增量更新校验和，
  *        最后将封装好的ICMP报文发送到IP层。  
  * 
  * @param buf 要处理的数据包
@@ -23,21 +22,19 @@ void icmp_in(buf_t *buf, uint8_t *src_ip)
     // TODO
     icmp_hdr_t *icmp_head = (icmp_hdr_t *)buf->data;
     if(icmp_head->type==ICMP_TYPE_ECHO_REQUEST ){ //查看该报文的 ICMP 类型是否为回显请求
-        //buf_t txbuf;
-        buf_init(&txbuf,buf->len);
-        icmp_hdr_t *icmp_tx = (icmp_hdr_t *)txbuf.data;
-        memcpy(txbuf.data,buf->data,buf->len);
+        //回显应答与请求只差类型和校验和，直接在收到的数据包上改写后发回，不另外拷贝；
+        //与别人共享缓冲区时先写时复制
+        if (buf_make_writable(buf) < 0) //缓冲池用尽，不回应
+            return;
+        icmp_head = (icmp_hdr_t *)buf->data;
 
-        //icmp_tx->type = 0;
-        icmp_tx->type = ICMP_TYPE_ECHO_REPLY; //回显应答
-        icmp_tx->checksum = 0;
-        //icmp_tx->id = swap16(1);
-        //icmp_tx->seq = swap16(seq);
-        //seq++;
-        
-        //memcpy(&txbuf.data+8,buf->data+8,buf->len-8); //数据部分
-        icmp_tx->checksum = checksum16((uint16_t *)txbuf.data,buf->len);
-        ip_out(&txbuf,src_ip,NET_PROTOCOL_ICMP); // 调用 ip_out 函数将数据报发送出去。
+        //只有类型所在的16位字改变，按RFC 1624增量更新校验和，不必重新扫描整个回显数据
+        uint16_t old_word, new_word;
+        memcpy(&old_word, icmp_head, sizeof(old_word));
+        icmp_head->type = ICMP_TYPE_ECHO_REPLY; //回显应答
+        memcpy(&new_word, icmp_head, sizeof(new_word));
+        icmp_head->checksum = checksum16_update16(icmp_head->checksum, old_word, new_word);
+        ip_out(buf,src_ip,NET_PROTOCOL_ICMP); // 调用 ip_out 函数将数据报发送出去。
 
     }
 
@@ -57,8 +54,9 @@ void icmp_in(buf_t *buf, uint8_t *src_ip)
 void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code)
 {
     // TODO
-    buf_t txbuf;
-    buf_init(&txbuf,sizeof(icmp_hdr_t) + sizeof(ip_hdr_t) + 8);
+    buf_t txbuf = {0};
+    if (buf_init(&txbuf,sizeof(icmp_hdr_t) + sizeof(ip_hdr_t) + 8) < 0)
+        return;
     uint8_t * p = txbuf.data;
 
     icmp_hdr_t *icmp_head = (icmp_hdr_t *)p;
@@ -73,6 +71,6 @@ void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code)
 
     icmp_head->checksum = checksum16((uint16_t *)txbuf.data,txbuf.len);
     ip_out(&txbuf,src_ip,NET_PROTOCOL_ICMP);
-
+    buf_free(&txbuf);
 }
 
@@ -2,6 +2,7 @@
 #include "arp.h"
 #include "icmp.h"
 #include "udp.h"
+#include "driver.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -9,9 +10,9 @@
  * @brief 处理一个收到的数据包
  *        你首先需要做报头检查，检查项包括：版本号、总长度、首部长度等。
  * 
- *        接着，计算头部校验和，注意：需要先把头部校验和字段缓存起来，再将校验和字段清零，
- *        调用checksum16()函数计算头部检验和，比较计算的结果与之前缓存的校验和是否一致，
- *        如果不一致，则不处理该数据报。
+ *        接着，连同校验和字段一起计算头部校验和，头部没有出错时结果为0，
+ *        否则不处理该数据报。头部在校验时不被改写。
+ *        后端的BUF_CSUM_VALID结论只涉及传输层校验和，IP头部总是由协议栈校验。
  * 
  *        检查收到的数据包的目的IP地址是否为本机的IP地址，只处理目的IP为本机的数据报。
  * 
@@ -33,11 +34,11 @@ void ip_in(buf_t *buf)
         printf("incorrect header\n");
         return;
     }
-    uint16_t my_checksum = ip_buf->hdr_checksum;
-    ip_buf->hdr_checksum = 0;
-    uint16_t checknum = checksum16((uint16_t *)buf->data,ip_buf->hdr_len*4);
-    //调用 checksum函数来计算头部校验和
-    if(my_checksum != checknum){
+    //连同校验和字段一起求和，头部正确时结果为0，不必先清零再写回
+    uint16_t checknum = ip_buf->hdr_len == 5 ? checksum16_ip_hdr(buf->data) : checksum16((uint16_t *)buf->data,ip_buf->hdr_len*4);
+    net_if_current->csum_stats.ip_verified++;
+    if(checknum != 0){
+        net_if_current->csum_stats.ip_bad++;
         printf("incorrect checksum\n");
         return;
     }
@@ -58,18 +59,109 @@ void ip_in(buf_t *buf)
         icmp_in(buf,src_ip);
     }
     else{ //不能识别的协议类型，调用 icmp_unreachable 返回 ICMP 协议不可达信息。
-        ip_buf->hdr_checksum = checknum;
         icmp_unreachable(buf,ip_buf->src_ip,ICMP_CODE_PROTOCOL_UNREACH);
     }
 
 }
 
 /**
- * @brief 处理一个要发送的ip分片
- *        你需要调用buf_add_header增加IP数据报头部缓存空间。
- *        填写IP数据报头部字段。
- *        将checksum字段填0，再调用checksum16()函数计算校验和，并将计算后的结果填写到checksum字段中。
- *        将封装后的IP数据报发送到arp层。
+ * @brief 早期分用：发给本机、无选项、未分片的UDP数据包不经ip_in()与udp_in()逐层处理，
+ *        用一次哈希查找直接交给udp处理程序
+ *        版本与首部长度、协议、分片字段与目的地址各用一次比较判断，
+ *        其余情况（选项、分片、ICMP、未打开的端口、校验和错误等）都退回逐层处理，
+ *        因此出错的数据包仍由ip_in()与udp_in()打印与计数
+ * 
+ * @param buf 要处理的包，data指向IP头部
+ * @return int 已处理为1；不满足条件为0，此时buf不变，由调用者交给ip_in()
+ */
+int ip_early_demux(buf_t *buf)
+{
+    net_if_t *nif = net_if_current;
+    ip_hdr_t *ip_buf = (ip_hdr_t *)buf->data;
+    uint8_t *data = buf->data;
+    uint16_t len = buf->len;
+    uint16_t total_len = swap16(ip_buf->total_len);
+    if (len < sizeof(ip_hdr_t) + sizeof(udp_hdr_t) ||
+        data[0] != (IP_VERSION_4 << 4 | 5) || ip_buf->protocol != NET_PROTOCOL_UDP ||
+        (ip_buf->flags_fragment & swap16(0x3fff)) != 0 || //MF位与分片偏移，DF位不影响
+        memcmp(ip_buf->dest_ip, net_if_ip, NET_IP_LEN) != 0 ||
+        total_len < sizeof(ip_hdr_t) + sizeof(udp_hdr_t) || total_len > len ||
+        checksum16_ip_hdr(data) != 0)
+    {
+        nif->demux_stats.misses++;
+        return 0;
+    }
+    uint8_t src_ip[NET_IP_LEN]; //处理程序可能在原地封装回复，改写IP头部
+    memcpy(src_ip, ip_buf->src_ip, NET_IP_LEN);
+    buf->data = data + sizeof(ip_hdr_t);
+    buf->len = total_len - sizeof(ip_hdr_t); //去掉以太网帧的填充
+    udp_entry_t *entry = udp_demux(buf, src_ip);
+    if (entry == NULL)
+    {
+        buf->data = data;
+        buf->len = len;
+        nif->demux_stats.misses++;
+        return 0;
+    }
+    nif->csum_stats.ip_verified++;
+    nif->demux_stats.hits++;
+    entry->handler(entry, src_ip, swap16(((udp_hdr_t *)(data + sizeof(ip_hdr_t)))->src_port), buf);
+    return 1;
+}
+
+/**
+ * @brief 以向量方式处理一批收到的IP数据包（ip4-input节点）
+ *        对每个数据包做与ip_early_demux()相同的首部检查，各项比较的结果按位与，不产生分支；
+ *        通过的数据包再校验头部校验和，去掉IP头部组成udp-input向量，整批交给udp_in_vec()。
+ *        其余数据包（选项、分片、ICMP、校验和错误等）之后按收包顺序交给ip_in()逐层处理
+ * 
+ * @param bufs 去掉以太网头的数据包
+ * @param n 数据包个数，不超过ETHERNET_BURST_MAX
+ */
+void ip_in_vec(buf_t **bufs, int n)
+{
+    net_if_t *nif = net_if_current;
+    buf_t *udp_bufs[ETHERNET_BURST_MAX], *slow_bufs[ETHERNET_BURST_MAX];
+    uint8_t udp_src[ETHERNET_BURST_MAX][NET_IP_LEN];
+    uint32_t my_ip;
+    memcpy(&my_ip, net_if_ip, NET_IP_LEN);
+    int m = 0, slow = 0;
+    for (int i = 0; i < n; i++)
+    {
+        buf_t *buf = bufs[i];
+        const uint8_t *p = buf->data;
+        uint32_t dest_ip;
+        uint16_t total_len, flags_fragment;
+        memcpy(&dest_ip, p + 16, sizeof(dest_ip));
+        memcpy(&total_len, p + 2, sizeof(total_len));
+        memcpy(&flags_fragment, p + 6, sizeof(flags_fragment));
+        total_len = swap16(total_len);
+        int fast = (buf->len >= sizeof(ip_hdr_t) + sizeof(udp_hdr_t)) &
+                   (p[0] == (IP_VERSION_4 << 4 | 5)) & (p[9] == NET_PROTOCOL_UDP) &
+                   ((flags_fragment & swap16(0x3fff)) == 0) & (dest_ip == my_ip) &
+                   (total_len >= sizeof(ip_hdr_t) + sizeof(udp_hdr_t)) & (total_len <= buf->len);
+        if (!fast || checksum16_ip_hdr(p) != 0)
+        {
+            slow_bufs[slow++] = buf;
+            continue;
+        }
+        memcpy(udp_src[m], p + 12, NET_IP_LEN);
+        buf->len = total_len - sizeof(ip_hdr_t); //去掉以太网帧的填充
+        buf->data += sizeof(ip_hdr_t);
+        udp_bufs[m++] = buf;
+        nif->csum_stats.ip_verified++;
+    }
+    if (m)
+        udp_in_vec(udp_bufs, udp_src, m);
+    nif->vector_stats.misses += slow;
+    for (int i = 0; i < slow; i++)
+        ip_in(slow_bufs[i]);
+}
+
+/**
+ * @brief 封装并发送一个ip分片
+ *        调用buf_add_header增加IP数据报头部缓存空间，填写IP数据报头部字段并计算校验和，
+ *        给出邻居句柄时经arp_out_neigh()发送，否则经arp_out()发送
  * 
  * @param buf 要发送的分片
  * @param ip 目标ip地址
@@ -77,15 +169,16 @@ void ip_in(buf_t *buf)
  * @param id 数据包id
  * @param offset 分片offset，必须被8整除
  * @param mf 分片mf标志，是否有下一个分片
+ * @param neigh 邻居句柄，可为NULL
  */
-void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf)
+static void ip_fragment_send(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf, arp_neigh_t *neigh)
 {
-    // TODO
-    buf_add_header(buf,20);
+    if (buf_add_header(buf,20) < 0)
+        return;
     struct ip_hdr *ip_buf = (struct ip_hdr *)buf->data;
     ip_buf->hdr_len = 5;
     ip_buf->version = IP_VERSION_4;
-    ip_buf->total_len = swap16(buf->len);
+    ip_buf->total_len = swap16(buf_total_len(buf));
     ip_buf->id = swap16(id); // 标识
     ip_buf->tos = 0; //服务类型
     ip_buf->ttl = 64; // 生存时间常设置为 64
@@ -97,9 +190,55 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
         ip_buf->flags_fragment = swap16((offset)+(mf << 13));
     }
     ip_buf->hdr_checksum =0;
-    ip_buf->hdr_checksum = checksum16((uint16_t *)buf->data,20);
-    arp_out(buf,ip,NET_PROTOCOL_IP);
-    
+    ip_buf->hdr_checksum = checksum16_ip_hdr(buf->data);
+    if (neigh)
+        arp_out_neigh(buf,ip,neigh);
+    else
+        arp_out(buf,ip,NET_PROTOCOL_IP);
+}
+
+/**
+ * @brief 处理一个要发送的ip分片
+ *        由ip_fragment_send()填写IP数据报头部字段、计算校验和，将封装后的IP数据报发送到arp层。
+ * 
+ * @param buf 要发送的分片
+ * @param ip 目标ip地址
+ * @param protocol 上层协议
+ * @param id 数据包id
+ * @param offset 分片offset，必须被8整除
+ * @param mf 分片mf标志，是否有下一个分片
+ */
+void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf)
+{
+    ip_fragment_send(buf, ip, protocol, id, offset, mf, NULL);
+}
+
+/**
+ * @brief 取出数据包从off开始、长为len的一段，组成引用原数据的链
+ * 
+ * @param buf 数据包，可以是链式数据包
+ * @param off 起始偏移
+ * @param len 长度
+ * @param slice 存放各段的数组，长度不小于buf的段数
+ */
+static void ip_slice(buf_t *buf, int off, int len, buf_t *slice)
+{
+    int n = 0;
+    for (; buf != NULL && len > 0; buf = buf->next)
+    {
+        if (off >= buf->len)
+        {
+            off -= buf->len;
+            continue;
+        }
+        int take = buf->len - off < len ? buf->len - off : len;
+        slice[n] = (buf_t){.len = take, .data = buf->data + off};
+        if (n > 0)
+            slice[n - 1].next = &slice[n];
+        n++;
+        len -= take;
+        off = 0;
+    }
 }
 
 /**
@@ -122,6 +261,19 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
  */
 int id = 0;
 void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+{
+    ip_out_neigh(buf, ip, protocol, NULL);
+}
+
+/**
+ * @brief 与ip_out()相同，各分片经邻居句柄发送，省去每个分片的arp表查找
+ * 
+ * @param buf 要处理的包
+ * @param ip 目标ip地址
+ * @param protocol 上层协议
+ * @param neigh 邻居句柄，可为NULL
+ */
+void ip_out_neigh(buf_t *buf, uint8_t *ip, net_protocol_t protocol, arp_neigh_t *neigh)
 {
     // TODO 
     // 检查从上层传递下来的数据报包长是否大于以太网帧的最大包长1500-14
@@ -129,37 +281,34 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
     struct ip_hdr ip_head;
     memcpy(&ip_head,buf,sizeof(ip_head));
     
+    net_if_t *prev_if = net_if_use(net_if_route(ip)); //从目的ip所在子网的接口发出
+    int max_len = (net_if_current->mtu - 20) & ~7; //分片长度必须是8的倍数
     uint16_t offset = 0; //ip fragment offset
+    int total = buf_total_len(buf);
     //如果超过以太网帧的最大包长，则需要分片发送
-    if(buf->len > 1480){
-        
-        buf_t new_buf;
-        uint8_t * p = buf->data;
-        int piece_num = (buf->len%(1480)==0)?
-        buf->len/1480:buf->len/1480+1;
-        
-        for(int i = 0;i < piece_num-1;i++){
-            buf_init(&new_buf,1480);
-            memcpy(new_buf.data,p,1480);
-            p += 1480;
-            new_buf.len = 1480;
-            ip_fragment_out(&new_buf,ip,protocol,id,offset,1);
-            offset += 185;
-            
+    //每个分片的ip头放在自己的小缓冲区中，数据只引用buf中对应的一段，不拷贝
+    if(total > max_len){
+        int segs = 0;
+        for (buf_t *b = buf; b != NULL; b = b->next)
+            segs++;
+        buf_t hdr = {0}, slice[segs];
+        for(int sent = 0; sent < total; sent += max_len){
+            int len = total - sent < max_len ? total - sent : max_len;
+            if (buf_init(&hdr,0) < 0) //缓冲池用尽，丢弃剩余的分片
+                break;
+            ip_slice(buf,sent,len,slice);
+            hdr.next = slice;
+            ip_fragment_send(&hdr,ip,protocol,id,offset,sent + len < total,neigh);
+            offset += max_len / 8;
         }
-        
-        int len = buf->len - (1480) * (piece_num-1);
-        memset(&new_buf,0,sizeof(new_buf));
-        buf_init(&new_buf,len);      
-        memcpy(new_buf.data,p,len);
-        
-        new_buf.len = len;
-        ip_fragment_out(&new_buf,ip,protocol,id,offset,0);
-
+        buf_free(&hdr);
     }
     else{ //没有超过以太网帧的最大包长，则直接调用 ip_fragment_out 函数
-        ip_fragment_out(buf,ip,protocol,id,0,0);
+        ip_fragment_send(buf,ip,protocol,id,0,0,neigh);
     }
+    if (total > max_len || buf->next != NULL) //发送队列引用了buf中的数据，返回前发出
+        driver_flush();
     id++;
+    net_if_use(prev_if);
 
 }
@@ -1,8 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include "net.h"
 #include "udp.h"
+#include "driver.h"
+#include "arp.h"
 
 void handler(udp_entry_t *entry, uint8_t *src_ip, uint16_t src_port, buf_t *buf)
 {
@@ -12,23 +15,48 @@ void handler(udp_entry_t *entry, uint8_t *src_ip, uint16_t src_port, buf_t *buf)
     putchar('\n');
     uint16_t len = 1800;
     //uint16_t len = 1000;
-    uint8_t data[len];
+    buf_t reply = {0};
+    if (udp_alloc(&reply, len) < 0) //直接在发送buffer中写数据，不经udp_send()拷贝
+        return;
 
     uint16_t dest_port = 60001;
     for (int i = 0; i < len; i++)
-        data[i] = i;
-    udp_send(data, len, 60000, src_ip, dest_port); //发送udp包
+        reply.data[i] = i;
+    udp_send_buf(&reply, 60000, src_ip, dest_port); //发送udp包
 }
 int main(int argc, char const *argv[])
 {
+    //命令行参数：
+    //  ./main tpacket 或 ./main tap:tap0          为默认接口指定网卡驱动后端
+    //  ./main -i "tap:tap0 10.0.0.2/24 02:00:00:00:00:02" -i ...  添加网络接口，可重复
+    //  ./main -f netif.conf                       从配置文件添加网络接口，每行一个
+    //  ./main -a 65536                            设置arp表容量，用于邻居很多的网络
+    for (int i = 1; i < argc; i++)
+    {
+        int ret;
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            ret = net_if_add(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            ret = net_if_load(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            ret = arp_set_max_entry(atoi(argv[++i]));
+        else
+            ret = driver_select(argv[i]);
+        if (ret < 0)
+            return -1;
+    }
 
     net_init();               //初始化协议栈
     udp_open(60000, handler); //注册端口的udp监听回调
 
+#if NET_EVENT_LOOP
+    net_loop(); //忙轮询+epoll的事件循环
+#else
     while (1)
     {
         net_poll(); //一次主循环
     }
+#endif
 
     return 0;
 }
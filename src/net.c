@@ -1,24 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "net.h"
 #include "arp.h"
 #include "udp.h"
 #include "ethernet.h"
+#include "driver.h"
+
+#define NET_MAX_FDS 16 //事件循环最多等待的网卡文件描述符数
+
+/**
+ * @brief 事件循环的统计计数
+ * 
+ */
+static net_stats_t net_stats;
+
+/**
+ * @brief 为1时net_ifs[0]仍是由config.h生成的默认接口，第一次net_if_add()时被替换
+ * 
+ */
+static int net_if_default = 1;
+
+/**
+ * @brief 解析点分十进制ip地址
+ * 
+ * @param str 字符串
+ * @param ip 解析出的ip地址
+ * @return int 成功为0，失败为-1
+ */
+static int net_parse_ip(const char *str, uint8_t *ip)
+{
+    unsigned int a[NET_IP_LEN];
+    char end;
+    if (sscanf(str, "%u.%u.%u.%u%c", &a[0], &a[1], &a[2], &a[3], &end) != 4)
+        return -1;
+    for (int i = 0; i < NET_IP_LEN; i++)
+    {
+        if (a[i] > 255)
+            return -1;
+        ip[i] = a[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief 解析以冒号分隔的mac地址
+ * 
+ * @param str 字符串
+ * @param mac 解析出的mac地址
+ * @return int 成功为0，失败为-1
+ */
+static int net_parse_mac(const char *str, uint8_t *mac)
+{
+    unsigned int a[NET_MAC_LEN];
+    char end;
+    if (sscanf(str, "%x:%x:%x:%x:%x:%x%c", &a[0], &a[1], &a[2], &a[3], &a[4], &a[5], &end) != 6)
+        return -1;
+    for (int i = 0; i < NET_MAC_LEN; i++)
+    {
+        if (a[i] > 255)
+            return -1;
+        mac[i] = a[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief 添加一个网络接口，需在net_init()之前调用
+ *        第一次添加时替换由config.h生成的默认接口
+ * 
+ * @param spec 接口描述，格式为"后端[:网卡名] ip[/前缀长度] mac [mtu]"，
+ *             如"tap:tap0 10.0.0.2/24 02:00:00:00:00:02 1500"
+ * @return int 成功为0，失败为-1
+ */
+int net_if_add(const char *spec)
+{
+    char backend[DRIVER_NAME_LEN + 16], addr[32], mac[32];
+    unsigned int prefix = 24, mtu = ETHERNET_MTU;
+    int n = sscanf(spec, "%271s %31s %31s %u", backend, addr, mac, &mtu);
+    if (n < 3 || mtu < 68 || mtu > ETHERNET_MTU)
+    {
+        fprintf(stderr, "Invalid interface: %s\n", spec);
+        return -1;
+    }
+    char *slash = strchr(addr, '/');
+    if (slash)
+    {
+        *slash = '\0';
+        prefix = atoi(slash + 1);
+    }
+
+    int index = net_if_default ? 0 : net_if_count;
+    if (index == NET_IF_MAX)
+    {
+        fprintf(stderr, "Too many interfaces, at most %d\n", NET_IF_MAX);
+        return -1;
+    }
+    net_if_t nif;
+    memset(&nif, 0, sizeof(nif));
+    if (net_parse_ip(addr, nif.ip) != 0 || net_parse_mac(mac, nif.mac) != 0 || prefix > 32)
+    {
+        fprintf(stderr, "Invalid interface: %s\n", spec);
+        return -1;
+    }
+    uint32_t mask = prefix ? 0xFFFFFFFFu << (32 - prefix) : 0;
+    for (int i = 0; i < NET_IP_LEN; i++)
+        nif.mask[i] = mask >> (24 - 8 * i);
+    nif.mtu = mtu;
+    nif.driver.rx_csum_offload = DRIVER_RX_CSUM_OFFLOAD;
+    snprintf(nif.driver.if_name, sizeof(nif.driver.if_name), "%s", DRIVER_IF_NAME);
+
+    net_ifs[index] = nif;
+    net_ifs[index].driver.mac = net_ifs[index].mac;
+    net_ifs[index].driver.ip = net_ifs[index].ip;
+    net_if_t *prev_if = net_if_use(&net_ifs[index]);
+    int ret = driver_select(backend);
+    net_if_use(prev_if);
+    if (ret != 0)
+        return -1;
+    net_if_count = index + 1;
+    net_if_default = 0;
+    return 0;
+}
 
 /**
- * @brief 初始化协议栈
+ * @brief 从配置文件添加网络接口，每行一个接口描述，#开头的行为注释
+ * 
+ * @param path 配置文件路径
+ * @return int 添加的接口个数，失败为-1
+ */
+int net_if_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    int count = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        if (net_if_add(p) != 0)
+        {
+            fclose(f);
+            return -1;
+        }
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+/**
+ * @brief 初始化协议栈，建立包内存区并报告使用的页面，再依次打开所有网络接口
  * 
  */
 void net_init()
 {
-    ethernet_init();
-    arp_init();
+    int mem = net_mem_init();
+    if (mem > 0 && NET_MEM_HUGEPAGE)
+        fprintf(stderr, "Warning: no %dMB hugepages available, packet memory falls back to regular pages\n", NET_MEM_HUGEPAGE);
+    else if (mem < 0)
+        fprintf(stderr, "Warning: failed to map the packet memory region\n");
+    printf("packet memory: %s\n", net_mem_mode());
+    for (int i = 0; i < net_if_count; i++)
+    {
+        net_if_use(&net_ifs[i]);
+        ethernet_init();
+        arp_init();
+    }
+    net_if_use(&net_ifs[0]);
     udp_init();
 }
 
 /**
- * @brief 一次协议栈轮询
+ * @brief 把所有网络接口发送队列中的数据包发出
  * 
  */
-void net_poll()
+static void net_flush()
 {
-    ethernet_poll();
-}
\ No newline at end of file
+    net_if_t *prev_if = net_if_current;
+    for (int i = 0; i < net_if_count; i++)
+    {
+        net_if_use(&net_ifs[i]);
+        driver_flush();
+    }
+    net_if_use(prev_if);
+}
+
+/**
+ * @brief 一次协议栈轮询，依次轮询每个网络接口
+ *        轮询结束时把本次积攒的待发送数据包一次发出
+ * 
+ * @return int 本次处理的数据包个数
+ */
+int net_poll()
+{
+    int n = 0;
+    for (int i = 0; i < net_if_count; i++)
+    {
+        net_if_use(&net_ifs[i]);
+        n += ethernet_poll();
+    }
+    net_flush();
+    net_stats.polls++;
+    if (n == 0)
+        net_stats.empty_spins++;
+    return n;
+}
+
+/**
+ * @brief 当前单调时钟，单位微秒
+ * 
+ * @return int64_t 时间
+ */
+static int64_t net_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief 运行各协议的定时处理
+ * 
+ * @return int64_t 距下一次需要定时处理的微秒数，没有需要等待的事件时为-1
+ */
+static int64_t net_timer()
+{
+    int sec = arp_timer();
+    net_flush();
+    net_stats.timer_fires++;
+    return sec < 0 ? -1 : (int64_t)sec * 1000000;
+}
+
+/**
+ * @brief 协议栈事件循环，不返回
+ *        有流量时忙轮询，空闲超过NET_BUSY_POLL_US后阻塞在epoll上，
+ *        等待网卡的文件描述符可读或定时器(timerfd)到期；
+ *        有接口的后端没有可等待的文件描述符时一直忙轮询
+ * 
+ */
+void net_loop()
+{
+    int fds[NET_MAX_FDS];
+    int nfds = 0;
+    for (int i = 0; i < net_if_count; i++)
+    {
+        net_if_use(&net_ifs[i]);
+        int n = driver_fds(fds + nfds, NET_MAX_FDS - nfds);
+        if (n == 0) //有一个接口无法等待，就只能一直忙轮询
+        {
+            nfds = 0;
+            break;
+        }
+        nfds += n;
+    }
+    int epfd = -1, tfd = -1;
+    struct epoll_event ev;
+
+    if (nfds > 0)
+    {
+        epfd = epoll_create1(0);
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (epfd < 0 || tfd < 0)
+        {
+            perror("Error in epoll_create1/timerfd_create");
+            nfds = 0;
+        }
+        for (int i = 0; i < nfds; i++)
+        {
+            ev.events = EPOLLIN;
+            ev.data.fd = fds[i];
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev);
+        }
+        if (nfds > 0)
+        {
+            ev.events = EPOLLIN;
+            ev.data.fd = tfd;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+        }
+    }
+
+    int64_t now = net_now_us();
+    int64_t last_busy = now;
+    int64_t next = net_timer();
+    int64_t deadline = next < 0 ? -1 : now + next; //下一次定时处理的时刻，-1表示没有
+
+    while (1)
+    {
+        if (net_poll() > 0)
+            last_busy = net_now_us();
+        now = net_now_us();
+        if (deadline >= 0 && now >= deadline)
+        {
+            next = net_timer();
+            deadline = next < 0 ? -1 : now + next;
+        }
+        if (nfds == 0 || now - last_busy < NET_BUSY_POLL_US)
+            continue;
+
+        //空闲，阻塞直到有数据包或定时器到期
+        if (deadline < 0) //上次没有要等待的事件，之后处理的数据包可能带来新的（如等待arp响应）
+        {
+            next = net_timer();
+            deadline = next < 0 ? -1 : now + next;
+        }
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        if (deadline >= 0)
+        {
+            int64_t wait = deadline > now ? deadline - now : 1;
+            its.it_value.tv_sec = wait / 1000000;
+            its.it_value.tv_nsec = wait % 1000000 * 1000;
+        }
+        timerfd_settime(tfd, 0, &its, NULL); //it_value全0时解除定时器
+
+        struct epoll_event events[NET_MAX_FDS + 1];
+        int n = epoll_wait(epfd, events, NET_MAX_FDS + 1, -1);
+        net_stats.wakeups++;
+        int rx = 0; //是否有网卡可读，只是定时器到期时处理完定时任务就回到阻塞，不再忙轮询
+        for (int i = 0; i < n; i++)
+            if (events[i].data.fd == tfd)
+            {
+                uint64_t expirations;
+                read(tfd, &expirations, sizeof(expirations)); //清除timerfd的可读状态
+            }
+            else
+                rx = 1;
+        if (rx)
+            last_busy = net_now_us();
+    }
+}
+
+/**
+ * @brief 获取事件循环的统计计数
+ * 
+ * @return const net_stats_t* 统计计数
+ */
+const net_stats_t *net_get_stats()
+{
+    return &net_stats;
+}
@@ -0,0 +1,75 @@
+#include <string.h>
+#include "net.h"
+#include "config.h"
+
+/**
+ * @brief 所有网络接口
+ *        未添加接口时只有一个由config.h生成的默认接口
+ * 
+ */
+net_if_t net_ifs[NET_IF_MAX] = {
+    {
+        .mac = DRIVER_IF_MAC,
+        .ip = DRIVER_IF_IP,
+        .mask = {255, 255, 255, 0},
+        .mtu = ETHERNET_MTU,
+        .driver = {
+            .ops = NULL, //未选择时使用DRIVER_BACKEND
+            .if_name = DRIVER_IF_NAME,
+            .mac = net_ifs[0].mac,
+            .ip = net_ifs[0].ip,
+            .rx_csum_offload = DRIVER_RX_CSUM_OFFLOAD,
+        },
+    },
+};
+
+int net_if_count = 1;
+
+net_if_t *net_if_current = &net_ifs[0];
+
+/**
+ * @brief 切换当前网络接口
+ * 
+ * @param nif 要切换到的网络接口
+ * @return net_if_t* 切换前的网络接口，用于恢复
+ */
+net_if_t *net_if_use(net_if_t *nif)
+{
+    net_if_t *prev = net_if_current;
+    net_if_current = nif;
+    return prev;
+}
+
+/**
+ * @brief 设置网络接口是否采信后端给出的接收校验和结论，需在net_init()之前调用
+ *        TAP后端据此决定是否让内核把校验和留给协议栈（此时数据包中的校验和尚未填写，只能采信）
+ * 
+ * @param nif 网络接口
+ * @param on 为1时采信，为0时所有数据包都由协议栈校验
+ */
+void net_if_set_rx_csum(net_if_t *nif, int on)
+{
+    nif->driver.rx_csum_offload = on;
+}
+
+/**
+ * @brief 查找发往目的ip应使用的网络接口
+ * 
+ * @param ip 目的ip地址
+ * @return net_if_t* 目的ip所在子网的接口，都不在时为默认接口
+ */
+net_if_t *net_if_route(const uint8_t *ip)
+{
+    if (net_if_count == 1)
+        return &net_ifs[0];
+    for (int i = 0; i < net_if_count; i++)
+    {
+        net_if_t *nif = &net_ifs[i];
+        int j = 0;
+        while (j < NET_IP_LEN && ((ip[j] ^ nif->ip[j]) & nif->mask[j]) == 0)
+            j++;
+        if (j == NET_IP_LEN)
+            return nif;
+    }
+    return &net_ifs[0];
+}
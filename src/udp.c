@@ -1,6 +1,7 @@
 #include "udp.h"
 #include "ip.h"
 #include "icmp.h"
+#include "driver.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,15 +12,81 @@
  */
 static udp_entry_t udp_table[UDP_MAX_HANDLER];
 
+#define UDP_HASH_SIZE (1 << UDP_HASH_BITS)
+_Static_assert(UDP_HASH_SIZE >= 2 * UDP_MAX_HANDLER, "udp hash table must stay at most half full");
+
+/**
+ * @brief 按目的端口查找处理程序的哈希表，线性探测，空槽为NULL
+ *        只含有效的表项，udp_table每次改动后重建
+ * 
+ */
+static udp_entry_t *udp_hash[UDP_HASH_SIZE];
+
+/**
+ * @brief 端口在哈希表中的起始槽，乘法散列取高位
+ * 
+ * @param port 端口号
+ * @return uint32_t 槽号
+ */
+static inline uint32_t udp_hash_slot(uint16_t port)
+{
+    return (uint32_t)(port * 2654435761u) >> (32 - UDP_HASH_BITS);
+}
+
+/**
+ * @brief 由udp_table重建哈希表
+ * 
+ */
+static void udp_rehash()
+{
+    memset(udp_hash, 0, sizeof(udp_hash));
+    for (int i = 0; i < UDP_MAX_HANDLER; i++)
+    {
+        if (!udp_table[i].valid)
+            continue;
+        uint32_t slot = udp_hash_slot(udp_table[i].port);
+        while (udp_hash[slot])
+            slot = (slot + 1) & (UDP_HASH_SIZE - 1);
+        udp_hash[slot] = &udp_table[i];
+    }
+}
+
+/**
+ * @brief 查找端口对应的处理程序，表至多半满，探测通常一次即遇到目标或空槽
+ * 
+ * @param port 端口号
+ * @return udp_entry_t* 找到的表项，端口未打开为NULL
+ */
+static udp_entry_t *udp_lookup(uint16_t port)
+{
+    for (uint32_t slot = udp_hash_slot(port);; slot = (slot + 1) & (UDP_HASH_SIZE - 1))
+    {
+        udp_entry_t *entry = udp_hash[slot];
+        if (entry == NULL || entry->port == port)
+            return entry;
+    }
+}
+
+/**
+ * @brief udp伪头部的部分和
+ *        伪头部的各字段直接以算术方式加进部分和，不再把伪头部写到IP头部的位置上
+ * 
+ * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址
+ * @param total_len UDP首部中的长度字段，网络字节序
+ * @return uint32_t 伪头部的部分和
+ */
+static uint32_t udp_pseudo_sum(const uint8_t *src_ip, const uint8_t *dest_ip, uint16_t total_len)
+{
+    uint16_t w[4];
+    memcpy(w, src_ip, NET_IP_LEN);
+    memcpy(w + 2, dest_ip, NET_IP_LEN);
+    return (uint32_t)w[0] + w[1] + w[2] + w[3] + swap16(NET_PROTOCOL_UDP) + total_len;
+}
+
 /**
  * @brief udp伪校验和计算
- *        1. 你首先调用buf_add_header()添加UDP伪头部
- *        2. 将IP头部拷贝出来，暂存被UDP伪头部覆盖的IP头部
- *        3. 填写UDP伪头部的12字节字段
- *        4. 计算UDP校验和，注意：UDP校验和覆盖了UDP头部、UDP数据和UDP伪头部
- *        5. 再将暂存的IP头部拷贝回来
- *        6. 调用buf_remove_header()函数去掉UDP伪头部
- *        7. 返回计算后的校验和。  
+ *        伪头部的部分和加上UDP头部与数据的部分和，折叠取反即为校验和，注意：UDP校验和覆盖了UDP头部、UDP数据和UDP伪头部
  * 
  * @param buf 要计算的包
  * @param src_ip 源ip地址
@@ -28,41 +95,37 @@ static udp_entry_t udp_table[UDP_MAX_HANDLER];
  */
 static uint16_t udp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
 {
-    // TODO
-    //icmp_hdr_t *icmp_head = (icmp_hdr_t *)buf->data;
-    //uint16_t len = buf->len;// udp 数据包本身的长度
-    //ip_hdr_t *ip_head = (ip_hdr_t *)(buf->data - sizeof(ip_hdr_t));
-    //uint8_t protocol = ip_head->protocol;
-    udp_hdr_t * udp_head = (udp_hdr_t *)buf->data;
-    buf_add_header(buf,sizeof(udp_peso_hdr_t)); //调用 buf_add_header 增加 UDP 报头
-    udp_peso_hdr_t *fake_head = (udp_peso_hdr_t *)buf->data;
-    udp_peso_hdr_t ip_head_buf;
-    memcpy(&ip_head_buf,fake_head,sizeof(udp_peso_hdr_t));// 用 memcpy 将 IP 头部拷贝出来，暂存被覆盖的 IP 头部
-    //填写 UDP 伪头部的 ?? 字节字段
-    memcpy(fake_head->src_ip,src_ip,sizeof(fake_head->src_ip));
-    memcpy(fake_head->dest_ip,dest_ip,sizeof(fake_head->dest_ip));
-    fake_head->placeholder = 0;
-    fake_head->total_len = udp_head->total_len;
-    fake_head->protocol = NET_PROTOCOL_UDP;
-    uint16_t checksum = checksum16((uint16_t *)buf->data,buf->len);//计算 UDP 校验和
-    memcpy(fake_head,&ip_head_buf,sizeof(udp_peso_hdr_t));//将暂存的 IP 头部拷贝回来
-    buf_remove_header(buf,sizeof(udp_peso_hdr_t));//调用 buf_remove_header 函数去掉 UDP 伪头部
-    return checksum;
-
-
+    udp_hdr_t *udp_head = (udp_hdr_t *)buf->data;
+    uint32_t sum = udp_pseudo_sum(src_ip, dest_ip, udp_head->total_len);
+    return checksum16_finish(checksum16_partial(buf->data, buf->len, sum));
+}
 
-    
+/**
+ * @brief 链式数据包各段的部分和
+ *        从奇数偏移开始的段，其部分和要交换高低字节后再合并
+ * 
+ * @param buf 数据包，可以是链式数据包
+ * @return uint32_t 部分和
+ */
+static uint32_t udp_data_sum(const buf_t *buf)
+{
+    uint32_t sum = 0;
+    size_t off = 0;
+    for (; buf; off += buf->len, buf = buf->next)
+    {
+        uint16_t seg = checksum16_partial(buf->data, buf->len, 0);
+        sum += (off & 1) ? (uint16_t)(seg << 8 | seg >> 8) : seg;
+    }
+    return sum;
 }
 
 /**
  * @brief 处理一个收到的udp数据包
  *        你首先需要检查UDP报头长度
- *        接着计算checksum，步骤如下：
- *          （1）先将UDP首部的checksum缓存起来
- *          （2）再将UDP首都的checksum字段清零
- *          （3）调用udp_checksum()计算UDP校验和
- *          （4）比较计算后的校验和与之前缓存的checksum进行比较，如不相等，则不处理该数据报。
- *       然后，根据该数据报目的端口号查找udp_table，查看是否有对应的处理函数（回调函数）
+ *        接着调用udp_checksum()连同checksum字段一起计算UDP校验和，
+ *        结果不为0说明数据报出错，不处理该数据报；校验时不改写UDP首部。
+ *        后端已把数据包标记为BUF_CSUM_VALID（内核或网卡已校验）时跳过计算。
+ *       然后，根据该数据报目的端口号用udp_lookup()查找哈希表，查看是否有对应的处理函数（回调函数）
  *       
  *       如果没有找到，则调用buf_add_header()函数增加IP数据报头部(想一想，此处为什么要增加IP头部？？)
  *       然后调用icmp_unreachable()函数发送一个端口不可达的ICMP差错报文。
@@ -77,22 +140,27 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
     // TODO
     if(buf->len < 8) return;//检测报头长度
     udp_hdr_t *udp_head = (udp_hdr_t *)buf->data;
-    uint16_t my_checksum = udp_head->checksum;
-    udp_head->checksum = 0;
-    uint16_t checksum = udp_checksum(buf,src_ip,net_if_ip);//重新计算 checksum
-    if(checksum != my_checksum) return; //校验和不相等
-    for(int i = 0;i < UDP_MAX_HANDLER;i++){//根据 UDP 数据报中的目的端口号查找 udp_table
-        if(udp_table[i].port == swap16(udp_head->dest_port) && udp_table[i].valid==1){
-            //如果能找到，则去掉 UDP 包头，接着调用处理函数（回调函数）来做相应处理
-            //uint16_t len = buf->len-8;
-            buf_remove_header(buf,8);
-            buf->len = swap16(udp_head ->total_len)-8;
-            udp_table[i].handler(&udp_table[i],src_ip,swap16(udp_head->src_port),buf);
+    if(buf->csum == BUF_CSUM_VALID) //内核或网卡已校验过
+        net_if_current->csum_stats.udp_trusted++;
+    else{
+        //连同校验和字段一起求和，数据报正确时结果为0，不必先清零再写回
+        net_if_current->csum_stats.udp_verified++;
+        if(udp_checksum(buf,src_ip,net_if_ip) != 0){ //校验和不相等
+            net_if_current->csum_stats.udp_bad++;
             return;
         }
     }
+    udp_entry_t *entry = udp_lookup(swap16(udp_head->dest_port));//根据 UDP 数据报中的目的端口号查找处理程序
+    if(entry){
+        //如果能找到，则去掉 UDP 包头，接着调用处理函数（回调函数）来做相应处理
+        buf_remove_header(buf,8);
+        buf->len = swap16(udp_head ->total_len)-8;
+        entry->handler(entry,src_ip,swap16(udp_head->src_port),buf);
+        return;
+    }
 // 如果没有找到该目的端口号对应的处理函数
-    buf_add_header(buf,sizeof(ip_hdr_t));//增加IPv4 数据报头部
+    if (buf_add_header(buf,sizeof(ip_hdr_t)) < 0)//增加IPv4 数据报头部
+        return;
     //调用 icmp_unreachable 发送一个端口不可达的 ICMP 差错报文
     icmp_unreachable(buf,src_ip,ICMP_CODE_PORT_UNREACH);
 
@@ -100,30 +168,119 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
 }
 
 /**
- * @brief 处理一个要发送的数据包
- *        你首先需要调用buf_add_header()函数增加UDP头部长度空间
- *        填充UDP首部字段
- *        调用udp_checksum()函数计算UDP校验和
- *        将封装的UDP数据报发送到IP层。    
+ * @brief 早期分用的udp部分：数据报完整、端口已打开且校验和正确时去掉UDP头部，返回应交给的处理程序
+ *        要求UDP长度与IP数据部分的长度相等，其余情况不改动buf也不计数，由调用者退回逐层处理
+ * 
+ * @param buf 要处理的包，len为IP数据部分的长度
+ * @param src_ip 源ip地址
+ * @return udp_entry_t* 处理程序的表项，不满足条件为NULL
+ */
+udp_entry_t *udp_demux(buf_t *buf, uint8_t *src_ip)
+{
+    udp_hdr_t *udp_head = (udp_hdr_t *)buf->data;
+    if (buf->len < sizeof(udp_hdr_t) || swap16(udp_head->total_len) != buf->len)
+        return NULL;
+    udp_entry_t *entry = udp_lookup(swap16(udp_head->dest_port));
+    if (entry == NULL)
+        return NULL;
+    if (buf->csum == BUF_CSUM_VALID)
+        net_if_current->csum_stats.udp_trusted++;
+    else if (udp_checksum(buf, src_ip, net_if_ip) == 0)
+        net_if_current->csum_stats.udp_verified++;
+    else
+        return NULL;
+    buf_remove_header(buf, sizeof(udp_hdr_t));
+    return entry;
+}
+
+/**
+ * @brief 以向量方式处理一批收到的udp数据报（udp-input节点）
+ *        按收包顺序用udp_demux()查找处理程序并校验，找到即调用；
+ *        未找到的数据报交给udp_in()，由它校验、计数并回送端口不可达
+ * 
+ * @param bufs 去掉IP头部的数据报，len为IP数据部分的长度
+ * @param src_ips 各数据报的源ip地址
+ * @param n 数据报个数，不超过ETHERNET_BURST_MAX
+ */
+void udp_in_vec(buf_t **bufs, uint8_t (*src_ips)[NET_IP_LEN], int n)
+{
+    net_if_t *nif = net_if_current;
+    for (int i = 0; i < n; i++)
+    {
+        buf_t *buf = bufs[i];
+        udp_entry_t *entry = udp_demux(buf, src_ips[i]);
+        if (entry == NULL)
+        {
+            nif->vector_stats.misses++;
+            udp_in(buf, src_ips[i]);
+            continue;
+        }
+        nif->vector_stats.hits++;
+        udp_hdr_t *udp_head = (udp_hdr_t *)(buf->data - sizeof(udp_hdr_t));
+        entry->handler(entry, src_ips[i], swap16(udp_head->src_port), buf);
+    }
+}
+
+/**
+ * @brief 封装并发送一个数据部分和已算好的udp包
+ *        调用buf_add_header()函数增加UDP头部长度空间，填充UDP首部字段，
+ *        校验和由伪头部、UDP头部与数据的部分和合并得到，数据不再读第二遍
  * 
  * @param buf 要处理的包
+ * @param data_sum 数据（含链上各段）的部分和
  * @param src_port 源端口号
  * @param dest_ip 目的ip地址
  * @param dest_port 目的端口号
+ * @param neigh 邻居句柄，可为NULL
  */
-void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+static void udp_output(buf_t *buf, uint32_t data_sum, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port, arp_neigh_t *neigh)
 {
-    // TODO
-    buf_add_header(buf,sizeof(udp_hdr_t));//调用 buf_add_header 增加 UDP 报头
-    udp_hdr_t *udp_head = (udp_hdr_t *)buf->data;// 填充 UDP 首部字段
+    if (buf_add_header(buf, sizeof(udp_hdr_t)) < 0)
+        return;
+    udp_hdr_t *udp_head = (udp_hdr_t *)buf->data;
     udp_head->src_port = swap16(src_port);
     udp_head->dest_port = swap16(dest_port);
     udp_head->checksum = 0;
-    udp_head->total_len = swap16(buf->len);
-    udp_checksum(buf,net_if_ip,dest_ip);//调用 udp_checksum 函数计算校验和
-    ip_out(buf,dest_ip,NET_PROTOCOL_UDP);//调用 ip_out 函数发送 UDP 数据报
+    udp_head->total_len = swap16(buf_total_len(buf)); //链式数据包包括后面各段
+    uint32_t sum = udp_pseudo_sum(net_if_ip, dest_ip, udp_head->total_len) + data_sum;
+    uint16_t checksum = checksum16_finish(checksum16_partial(udp_head, sizeof(udp_hdr_t), sum));
+    udp_head->checksum = checksum ? checksum : 0xffff; //算得0时发送全1，0表示未计算校验和
+    ip_out_neigh(buf, dest_ip, NET_PROTOCOL_UDP, neigh);
+}
 
+/**
+ * @brief 处理一个要发送的数据包
+ *        先计算数据的部分和，再封装UDP首部发送到IP层
+ * 
+ * @param buf 要处理的包
+ * @param src_port 源端口号
+ * @param dest_ip 目的ip地址
+ * @param dest_port 目的端口号
+ */
+void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+{
+    udp_output(buf, udp_data_sum(buf), src_port, dest_ip, dest_port, NULL);
+}
 
+/**
+ * @brief 把已打开的udp端口同步到所有网卡的内核过滤程序，未打开端口的udp包在内核中丢弃
+ * 
+ */
+static void udp_update_filter()
+{
+    uint16_t ports[UDP_MAX_HANDLER];
+    int n = 0;
+    for (int i = 0; i < UDP_MAX_HANDLER; i++)
+        if (udp_table[i].valid)
+            ports[n++] = udp_table[i].port;
+
+    net_if_t *prev_if = net_if_current;
+    for (int i = 0; i < net_if_count; i++)
+    {
+        net_if_use(&net_ifs[i]);
+        driver_set_filter(ports, n);
+    }
+    net_if_use(prev_if);
 }
 
 /**
@@ -134,6 +291,8 @@ void udp_init()
 {
     for (int i = 0; i < UDP_MAX_HANDLER; i++)
         udp_table[i].valid = 0;
+    udp_rehash();
+    udp_update_filter();
 }
 
 /**
@@ -150,6 +309,8 @@ int udp_open(uint16_t port, udp_handler_t handler)
         {
             udp_table[i].handler = handler;
             udp_table[i].valid = 1;
+            udp_rehash();
+            udp_update_filter();
             return 0;
         }
 
@@ -159,6 +320,8 @@ int udp_open(uint16_t port, udp_handler_t handler)
             udp_table[i].handler = handler;
             udp_table[i].port = port;
             udp_table[i].valid = 1;
+            udp_rehash();
+            udp_update_filter();
             return 0;
         }
     return -1;
@@ -174,10 +337,13 @@ void udp_close(uint16_t port)
     for (int i = 0; i < UDP_MAX_HANDLER; i++)
         if (udp_table[i].port == port)
             udp_table[i].valid = 0;
+    udp_rehash();
+    udp_update_filter();
 }
 
 /**
  * @brief 发送一个udp包
+ *        数据拷贝进txbuf的同时计算部分和，发送时只需再加上伪头部与UDP头部
  * 
  * @param data 要发送的数据
  * @param len 数据长度
@@ -187,7 +353,102 @@ void udp_close(uint16_t port)
  */
 void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
 {
-    buf_init(&txbuf, len);
-    memcpy(txbuf.data, data, len);
-    udp_out(&txbuf, src_port, dest_ip, dest_port);
-}
\ No newline at end of file
+    buf_t txbuf = {0};
+    if (buf_init(&txbuf, len) < 0)
+        return;
+    uint32_t sum = checksum16_copy(txbuf.data, data, len, 0); //拷贝的同时求和
+    udp_output(&txbuf, sum, src_port, dest_ip, dest_port, NULL);
+    buf_free(&txbuf);
+}
+
+/**
+ * @brief 为要发送的udp包分配buffer，数据前留有以太网、IP与UDP头部的余量
+ *        缓冲池的buffer在数据前留有BUF_HEADROOM的余量，足够放下三层头部
+ * 
+ * @param buf 分配到的buffer，data指向长为len的数据区
+ * @param len 数据长度
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int udp_alloc(buf_t *buf, uint16_t len)
+{
+    return buf_init(buf, len);
+}
+
+/**
+ * @brief 发送udp_alloc()分配并已写好数据的udp包，发送后释放buf
+ * 
+ * @param buf 要发送的包
+ * @param src_port 源端口号
+ * @param dest_ip 目的ip地址
+ * @param dest_port 目的端口号
+ */
+void udp_send_buf(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+{
+    udp_out(buf, src_port, dest_ip, dest_port);
+    buf_free(buf);
+}
+
+/**
+ * @brief 把调用者的若干段数据拼成一个udp包发送，各段只引用不拷贝
+ *        UDP头部放在一个空的小缓冲区中，后面链上引用各段的buffer；
+ *        ip_out()发送链式数据包后会立即把发送队列发出，所以返回后各段不再被引用
+ * 
+ * @param iov 数据的各段
+ * @param iovcnt 段数
+ * @param src_port 源端口号
+ * @param dest_ip 目的ip地址
+ * @param dest_port 目的端口号
+ * @return int 成功为0，数据过长或缓冲池用尽为-1
+ */
+int udp_sendv(const struct iovec *iov, int iovcnt, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+{
+    buf_t hdr = {0}, segs[iovcnt > 0 ? iovcnt : 1];
+    buf_t *tail = &hdr;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    if (total > UINT16_MAX - sizeof(udp_hdr_t) - sizeof(ip_hdr_t))
+        return -1;
+    if (buf_init(&hdr, 0) < 0)
+        return -1;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_len == 0)
+            continue;
+        segs[i] = (buf_t){.len = iov[i].iov_len, .data = iov[i].iov_base};
+        tail->next = &segs[i];
+        tail = &segs[i];
+    }
+    tail->next = NULL;
+    udp_out(&hdr, src_port, dest_ip, dest_port);
+    buf_free(&hdr);
+    return 0;
+}
+
+/**
+ * @brief 初始化一个已连接的udp发送者，邻居句柄在第一次发送时填写
+ * 
+ * @param conn 发送者
+ * @param src_port 源端口号
+ * @param dest_ip 目的ip地址
+ * @param dest_port 目的端口号
+ */
+void udp_connect(udp_conn_t *conn, uint16_t src_port, const uint8_t *dest_ip, uint16_t dest_port)
+{
+    conn->src_port = src_port;
+    conn->dest_port = dest_port;
+    memcpy(conn->dest_ip, dest_ip, NET_IP_LEN);
+    conn->neigh = (arp_neigh_t){0};
+}
+
+/**
+ * @brief 经已连接的发送者发送udp_alloc()分配并已写好数据的udp包，发送后释放buf
+ * 
+ * @param conn 发送者
+ * @param buf 要发送的包
+ */
+void udp_conn_send_buf(udp_conn_t *conn, buf_t *buf)
+{
+    udp_output(buf, udp_data_sum(buf), conn->src_port, conn->dest_ip, conn->dest_port, &conn->neigh);
+    buf_free(buf);
+}
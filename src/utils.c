@@ -2,7 +2,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #define IPTOSBUFFERS 12
+#define NET_MEM_PAGE 4096 //普通页大小，不小于一页的分配按页对齐
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
 
 /**
  * @brief ip转字符串
@@ -20,27 +26,422 @@ char *iptos(uint8_t *ip)
 }
 
 /**
- * @brief 初始化buffer为给定的长度，用于装载数据包
+ * @brief 包内存区，按顺序切分给缓冲池、发送队列与环形队列，从不归还
+ * 
+ */
+static struct
+{
+    uint8_t *base;    //起始地址，未建立时为NULL
+    size_t size;      //大小
+    size_t used;      //已分配的长度
+    int huge;         //是否由大页支撑
+    const char *mode; //使用的页面
+} net_mem = {.mode = "not initialized"};
+
+/**
+ * @brief 映射一段匿名内存
+ * 
+ * @param size 大小
+ * @param flags 附加的mmap标志，如MAP_HUGETLB
+ * @return void* 映射到的内存，失败为NULL
+ */
+static void *net_mem_map(size_t size, int flags)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/**
+ * @brief 建立包内存区：一整块由大页支撑的内存，缓冲池、发送队列与环形队列都从中分配，减少TLB缺失
+ *        依次尝试不大于NET_MEM_HUGEPAGE的1GB、2MB hugetlb大页，都得不到（如大页池为空）时
+ *        退回普通页，并建议内核用透明大页合并
+ * 
+ * @return int 使用大页为0，退回普通页为1，连普通页也分配不到为-1
+ */
+int net_mem_init()
+{
+    static const struct
+    {
+        int mb;           //大页大小(MB)
+        int shift;        //大页大小的对数，编码进mmap标志
+        const char *mode; //报告用的名称
+    } pages[] = {{1024, 30, "1GB hugepages"}, {2, 21, "2MB hugepages"}};
+    if (net_mem.base != NULL)
+        return !net_mem.huge;
+    for (size_t i = 0; i < sizeof(pages) / sizeof(pages[0]); i++)
+    {
+        if (pages[i].mb > NET_MEM_HUGEPAGE)
+            continue;
+        size_t page = (size_t)pages[i].mb << 20;
+        size_t size = ((size_t)NET_MEM_SIZE + page - 1) & ~(page - 1);
+        net_mem.base = net_mem_map(size, MAP_HUGETLB | MAP_POPULATE | pages[i].shift << MAP_HUGE_SHIFT);
+        if (net_mem.base != NULL)
+        {
+            net_mem.size = size;
+            net_mem.huge = 1;
+            net_mem.mode = pages[i].mode;
+            return 0;
+        }
+    }
+    net_mem.base = net_mem_map(NET_MEM_SIZE, 0);
+    if (net_mem.base == NULL)
+    {
+        net_mem.mode = "unavailable";
+        return -1;
+    }
+    net_mem.size = NET_MEM_SIZE;
+    net_mem.mode = "regular pages";
+#ifdef MADV_HUGEPAGE
+    if (madvise(net_mem.base, net_mem.size, MADV_HUGEPAGE) == 0)
+        net_mem.mode = "regular pages (transparent hugepages advised)";
+#endif
+    return 1;
+}
+
+/**
+ * @brief 从包内存区分配一段清零的内存，不能释放，随进程存在
+ *        包内存区用尽时单独映射普通页，并在第一次时警告
+ * 
+ * @param size 大小
+ * @return void* 分配到的内存，失败为NULL
+ */
+void *net_mem_alloc(size_t size)
+{
+    size_t align = size >= NET_MEM_PAGE ? NET_MEM_PAGE : 64;
+    if (net_mem.base == NULL)
+        net_mem_init();
+    size_t off = (net_mem.used + align - 1) & ~(align - 1);
+    if (net_mem.base != NULL && off + size <= net_mem.size)
+    {
+        net_mem.used = off + size;
+        return net_mem.base + off;
+    }
+    static int warned;
+    if (net_mem.base != NULL && !warned)
+    {
+        fprintf(stderr, "Warning: packet memory region full (%zu bytes), increase NET_MEM_SIZE\n", net_mem.size);
+        warned = 1;
+    }
+    return net_mem_map(size, 0);
+}
+
+/**
+ * @brief 包内存区使用的页面，用于启动时报告
+ * 
+ * @return const char* 如"2MB hugepages"
+ */
+const char *net_mem_mode()
+{
+    return net_mem.mode;
+}
+
+/**
+ * @brief 缓冲区头部，放在每个缓冲区的数据区之前
+ *        引用计数与所属的类别、下标都记在缓冲区自己身上，释放时由head直接找到，与buf本身放在哪里无关
+ * 
+ */
+typedef struct buf_hdr
+{
+    uint32_t refcnt; //持有该缓冲区的buf个数，0为空闲
+    uint16_t cls;    //大小类别
+    uint16_t slot;   //在该类别缓冲区数组中的下标
+} buf_hdr_t;
+
+_Static_assert(sizeof(buf_hdr_t) % 8 == 0, "head stays 8-byte aligned");
+_Static_assert(BUF_POOL_SMALL_NR <= 65536 && BUF_POOL_LARGE_NR <= 65536, "slot fits in buf_hdr_t");
+
+/**
+ * @brief 缓冲池的一个大小类别
+ *        缓冲区在第一次使用时从包内存区分配成连续的数组，每个缓冲区前是它的buf_hdr_t，
+ *        空闲的缓冲区用下标栈管理，最近归还的先被取出，缓存更热
+ * 
+ */
+typedef struct buf_pool
+{
+    uint8_t *base;                   //缓冲区数组
+    int size;                        //每个缓冲区的大小，不含头部
+    int stride;                      //相邻缓冲区的间隔，头部加缓冲区按缓存行取整
+    int nr;                          //缓冲区个数
+    int *free;                       //空闲缓冲区的下标栈
+    int free_nr;                     //空闲缓冲区个数
+} buf_pool_t;
+
+static buf_pool_t buf_pools[BUF_CLASS_NR] = {
+    [BUF_CLASS_SMALL] = {.size = BUF_SMALL_SIZE, .nr = BUF_POOL_SMALL_NR, .free_nr = -1},
+    [BUF_CLASS_LARGE] = {.size = BUF_LARGE_SIZE, .nr = BUF_POOL_LARGE_NR, .free_nr = -1},
+};
+
+static buf_pool_stats_t buf_stats[BUF_CLASS_NR] = {
+    [BUF_CLASS_SMALL] = {.total = BUF_POOL_SMALL_NR},
+    [BUF_CLASS_LARGE] = {.total = BUF_POOL_LARGE_NR},
+};
+
+/**
+ * @brief buf持有的缓冲区的头部
+ * 
+ * @param buf head不为NULL的buffer
+ * @return buf_hdr_t* 缓冲区头部
+ */
+static inline buf_hdr_t *buf_hdr(const buf_t *buf)
+{
+    return (buf_hdr_t *)buf->head - 1;
+}
+
+/**
+ * @brief buf是否持有缓冲区且数据位于其中
+ *        零拷贝接收等把data指向缓冲区之外时，不能据此共享或改写
+ * 
+ * @param buf buffer
+ * @return int 是为1，否则为0
+ */
+static int buf_owns_data(const buf_t *buf)
+{
+    return buf->head != NULL && buf->data >= buf->head && buf->data <= buf->head + buf_pools[buf_hdr(buf)->cls].size;
+}
+
+/**
+ * @brief 放弃一个对缓冲区的引用，最后一个引用放弃时缓冲区回到缓冲池
+ * 
+ * @param hdr 缓冲区头部
+ */
+static void buf_hdr_put(buf_hdr_t *hdr)
+{
+    if (--hdr->refcnt > 0)
+        return;
+    buf_pool_t *pool = &buf_pools[hdr->cls];
+    pool->free[pool->free_nr++] = hdr->slot;
+    buf_stats[hdr->cls].in_use--;
+}
+
+/**
+ * @brief 从包内存区分配一个大小类别的缓冲区数组，填写各缓冲区的头部，并建立空闲栈
+ * 
+ * @param pool 大小类别
+ * @param cls 大小类别的编号
+ * @return int 成功为0，包内存区分配失败为-1，此后该类别一直为空
+ */
+static int buf_pool_setup(buf_pool_t *pool, int cls)
+{
+    pool->stride = (sizeof(buf_hdr_t) + pool->size + 63) & ~63;
+    pool->base = net_mem_alloc((size_t)pool->stride * pool->nr);
+    pool->free = net_mem_alloc(pool->nr * sizeof(*pool->free));
+    if (!pool->base || !pool->free)
+    {
+        pool->base = NULL;
+        return -1;
+    }
+    for (int i = 0; i < pool->nr; i++)
+    {
+        buf_hdr_t *hdr = (buf_hdr_t *)(pool->base + (size_t)i * pool->stride);
+        *hdr = (buf_hdr_t){.refcnt = 0, .cls = cls, .slot = i};
+    }
+    for (pool->free_nr = 0; pool->free_nr < pool->nr; pool->free_nr++)
+        pool->free[pool->free_nr] = pool->nr - 1 - pool->free_nr;
+    return 0;
+}
+
+/**
+ * @brief 从缓冲池取一个缓冲区交给buf，buf原来的head被覆盖
+ * 
+ * @param buf buffer
+ * @param cls 大小类别
+ * @return int 成功为0，该类别已用尽为-1
+ */
+static int buf_pool_get(buf_t *buf, int cls)
+{
+    buf_pool_t *pool = &buf_pools[cls];
+    buf_pool_stats_t *st = &buf_stats[cls];
+    if (pool->free_nr < 0 && buf_pool_setup(pool, cls) < 0) //第一次使用时从包内存区分配
+        pool->free_nr = 0;
+    if (pool->free_nr == 0)
+    {
+        st->exhausted++;
+        return -1;
+    }
+    buf_hdr_t *hdr = (buf_hdr_t *)(pool->base + (size_t)pool->free[--pool->free_nr] * pool->stride);
+    hdr->refcnt = 1;
+    buf->head = (uint8_t *)(hdr + 1);
+    if (++st->in_use > st->peak)
+        st->peak = st->in_use;
+    return 0;
+}
+
+/**
+ * @brief 初始化buffer为给定的长度，数据起始地址按8字节对齐后再偏移reserve
+ *        buf独占同一大小类别的缓冲区时直接复用，否则放弃原来的引用并从缓冲池取一个，
+ *        小缓冲区用尽时改用大缓冲区
  * 
  * @param buf 要初始化的buffer
  * @param len 长度
+ * @param reserve 对齐后在数据前多留出的字节数，小于8
+ * @return int 成功为0，缓冲池用尽或长度过大为-1
  */
-void buf_init(buf_t *buf, int len)
+static int buf_init_aligned(buf_t *buf, int len, int reserve)
 {
+    int cls = len + reserve + BUF_HEADROOM <= BUF_SMALL_SIZE ? BUF_CLASS_SMALL : BUF_CLASS_LARGE;
+    if (len > BUF_MAX_LEN)
+        goto fail;
+    if (buf->head == NULL || buf_hdr(buf)->cls != cls || buf_hdr(buf)->refcnt > 1)
+    {
+        buf_free(buf);
+        while (buf_pool_get(buf, cls) < 0)
+            if (++cls == BUF_CLASS_NR)
+                goto fail;
+    }
     buf->len = len;
-    buf->data = buf->payload + BUF_MAX_LEN - len;
+    buf->data = buf->head + ((buf_pools[cls].size - len - reserve) & ~7) + reserve;
+    buf->next = NULL;
+    buf->csum = BUF_CSUM_NONE;
+    return 0;
+
+fail:
+    buf_free(buf);
+    buf->len = 0;
+    buf->data = NULL;
+    buf->next = NULL;
+    buf->csum = BUF_CSUM_NONE;
+    return -1;
+}
+
+/**
+ * @brief 初始化buffer为给定的长度，用于装载数据包
+ *        数据起始地址8字节对齐，之后添加的UDP/ICMP头8字节对齐、IP头4字节对齐
+ * 
+ * @param buf 要初始化的buffer
+ * @param len 长度
+ * @return int 成功为0，缓冲池用尽或长度过大为-1
+ */
+int buf_init(buf_t *buf, int len)
+{
+    return buf_init_aligned(buf, len, 0);
+}
+
+/**
+ * @brief 初始化buffer用于装载收到的以太网帧
+ *        帧前多留出NET_IP_ALIGN字节，使以太网头之后的IP头自然对齐
+ * 
+ * @param buf 要初始化的buffer
+ * @param len 帧长度
+ * @return int 成功为0，缓冲池用尽或长度过大为-1
+ */
+int buf_init_frame(buf_t *buf, int len)
+{
+    return buf_init_aligned(buf, len, NET_IP_ALIGN);
+}
+
+/**
+ * @brief 放弃buffer对缓冲区的引用
+ * 
+ * @param buf 要释放的buffer
+ */
+void buf_free(buf_t *buf)
+{
+    if (buf->head != NULL)
+        buf_hdr_put(buf_hdr(buf));
+    buf->head = NULL;
+}
+
+/**
+ * @brief 让dst与src共享同一个缓冲区，只增加引用计数
+ * 
+ * @param dst 目的buffer
+ * @param src 源buffer
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int buf_clone(buf_t *dst, buf_t *src)
+{
+    if (dst == src)
+        return 0;
+    if (src->next != NULL || !buf_owns_data(src)) //链式数据包或数据不在缓冲池中，只能拷贝
+        return buf_copy(dst, src);
+    buf_hdr_t *hdr = buf_hdr(src);
+    hdr->refcnt++; //先加后减，dst原来持有的正是同一个缓冲区时不会被提前归还
+    buf_free(dst);
+    buf_stats[hdr->cls].clones++;
+    dst->head = src->head;
+    dst->len = src->len;
+    dst->data = src->data;
+    dst->next = NULL;
+    dst->csum = src->csum;
+    return 0;
+}
+
+/**
+ * @brief 写时复制：buffer与别人共享缓冲区时，把数据拷贝到自己独占的新缓冲区，头部余量保持不变
+ * 
+ * @param buf 要修改的buffer
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int buf_make_writable(buf_t *buf)
+{
+    if (!buf_owns_data(buf) || buf_hdr(buf)->refcnt == 1)
+        return 0;
+    buf_hdr_t *old = buf_hdr(buf);
+    uint8_t *old_data = buf->data;
+    if (buf_pool_get(buf, old->cls) < 0)
+    {
+        buf->head = (uint8_t *)(old + 1);
+        return -1;
+    }
+    buf->data = buf->head + (old_data - (uint8_t *)(old + 1));
+    memcpy(buf->data, old_data, buf->len);
+    buf_hdr_put(old);
+    buf_stats[old->cls].cow_copies++;
+    return 0;
+}
+
+/**
+ * @brief 链式数据包的总长度
+ * 
+ * @param buf 数据包的第一段
+ * @return int 各段长度之和
+ */
+int buf_total_len(const buf_t *buf)
+{
+    int len = 0;
+    for (; buf != NULL; buf = buf->next)
+        len += buf->len;
+    return len;
+}
+
+/**
+ * @brief buffer在数据前还能添加的头部长度
+ * 
+ * @param buf buffer
+ * @return int 头部余量，数据不在自己的缓冲区中时为0
+ */
+int buf_headroom(const buf_t *buf)
+{
+    if (buf_owns_data(buf))
+        return buf->data - buf->head;
+    return 0;
+}
+
+/**
+ * @brief 获取缓冲池的统计计数
+ * 
+ * @return const buf_pool_stats_t* 按buf_class_t索引的统计计数
+ */
+const buf_pool_stats_t *buf_pool_get_stats()
+{
+    return buf_stats;
 }
 
 /**
  * @brief 为buffer在头部增加一段长度，用于添加协议头
+ *        头部余量与别人共享时先写时复制，避免改写别人的数据
  * 
  * @param buf 要修改的buffer
  * @param len 增加的长度
+ * @return int 成功为0，写时复制时缓冲池用尽为-1
  */
-void buf_add_header(buf_t *buf, int len)
+int buf_add_header(buf_t *buf, int len)
 {
+    if (buf_make_writable(buf) < 0)
+        return -1;
     buf->len += len;
     buf->data -= len;
+    return 0;
 }
 
 /**
@@ -57,24 +458,364 @@ void buf_remove_header(buf_t *buf, int len)
 
 /**
  * @brief 复制一个buffer到新buffer
+ *        只拷贝有效数据，源buffer的数据可以不在自己的缓冲区中（如零拷贝接收的数据包），
+ *        链式数据包的各段依次拼接成连续的一段
  * 
  * @param dst 目的buffer
  * @param src 源buffer
+ * @return int 成功为0，缓冲池用尽为-1
+ */
+int buf_copy(buf_t *dst, buf_t *src)
+{
+    if (buf_init(dst, buf_total_len(src)) < 0)
+        return -1;
+    dst->csum = src->csum;
+    uint8_t *p = dst->data;
+    for (; src != NULL; src = src->next)
+    {
+        memcpy(p, src->data, src->len);
+        p += src->len;
+    }
+    return 0;
+}
+
+/*
+ * 16位反码和与字节序无关：按内存中的原样取字求和，折叠取反后原样写回即为网络字节序的校验和。
+ * 又因为2^16 ≡ 1 (mod 0xffff)，把数据看成32位字求和、最后再折叠，与逐个16位字求和结果相同，
+ * 因此各实现都把32位字累加到64位累加器中，长度不超过2^31时不会溢出，也不用处理进位
+ */
+
+typedef uint64_t (*checksum_add_t)(const uint8_t *p, size_t len, uint64_t sum);
+typedef uint64_t (*checksum_copy_t)(uint8_t *dst, const uint8_t *p, size_t len, uint64_t sum);
+
+/**
+ * @brief 把64位的累加和折叠成16位反码和
+ * 
+ * @param sum 累加和
+ * @return uint16_t 反码和，未取反
+ */
+static inline uint16_t checksum_fold(uint64_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+/**
+ * @brief 标量实现，也是各SIMD实现处理尾部的参考实现
+ *        奇数长度时最后一个字节作为高位字节，与补一个0字节后的字相同
+ * 
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
+ */
+static uint64_t checksum_add_scalar(const uint8_t *p, size_t len, uint64_t sum)
+{
+    uint32_t w[4];
+    for (; len >= 16; p += 16, len -= 16)
+    {
+        memcpy(w, p, 16);
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+    }
+    for (; len >= 4; p += 4, len -= 4)
+    {
+        memcpy(w, p, 4);
+        sum += w[0];
+    }
+    uint16_t h = 0;
+    if (len >= 2)
+    {
+        memcpy(&h, p, 2);
+        sum += h;
+        p += 2;
+        len -= 2;
+    }
+    if (len)
+    {
+        h = 0;
+        memcpy(&h, p, 1);
+        sum += h;
+    }
+    return sum;
+}
+
+/**
+ * @brief 标量实现的拷贝并求和，每个32位字读一次，同时写到目的地址并累加
+ * 
+ * @param dst 目的地址
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
+ */
+static uint64_t checksum_copy_scalar(uint8_t *dst, const uint8_t *p, size_t len, uint64_t sum)
+{
+    uint32_t w[4];
+    for (; len >= 16; p += 16, dst += 16, len -= 16)
+    {
+        memcpy(w, p, 16);
+        memcpy(dst, w, 16);
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+    }
+    memcpy(dst, p, len);
+    return checksum_add_scalar(dst, len, sum);
+}
+
+#if NET_CHECKSUM_SIMD && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+
+/**
+ * @brief SSE2实现：每次取两个16字节向量，32位字与0交错展开成64位后累加
+ * 
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
+ */
+__attribute__((target("sse2"))) static uint64_t checksum_add_sse2(const uint8_t *p, size_t len, uint64_t sum)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, b = zero, c = zero, d = zero;
+    for (; len >= 32; p += 32, len -= 32)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+        a = _mm_add_epi64(a, _mm_unpacklo_epi32(v0, zero));
+        b = _mm_add_epi64(b, _mm_unpackhi_epi32(v0, zero));
+        c = _mm_add_epi64(c, _mm_unpacklo_epi32(v1, zero));
+        d = _mm_add_epi64(d, _mm_unpackhi_epi32(v1, zero));
+    }
+    a = _mm_add_epi64(_mm_add_epi64(a, b), _mm_add_epi64(c, d));
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, a);
+    return checksum_add_scalar(p, len, sum + lanes[0] + lanes[1]);
+}
+
+/**
+ * @brief SSE2实现的拷贝并求和，载入的向量先写到目的地址再展开累加
+ * 
+ * @param dst 目的地址
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
+ */
+__attribute__((target("sse2"))) static uint64_t checksum_copy_sse2(uint8_t *dst, const uint8_t *p, size_t len, uint64_t sum)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, b = zero, c = zero, d = zero;
+    for (; len >= 32; p += 32, dst += 32, len -= 32)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+        _mm_storeu_si128((__m128i *)dst, v0);
+        _mm_storeu_si128((__m128i *)(dst + 16), v1);
+        a = _mm_add_epi64(a, _mm_unpacklo_epi32(v0, zero));
+        b = _mm_add_epi64(b, _mm_unpackhi_epi32(v0, zero));
+        c = _mm_add_epi64(c, _mm_unpacklo_epi32(v1, zero));
+        d = _mm_add_epi64(d, _mm_unpackhi_epi32(v1, zero));
+    }
+    a = _mm_add_epi64(_mm_add_epi64(a, b), _mm_add_epi64(c, d));
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, a);
+    return checksum_copy_scalar(dst, p, len, sum + lanes[0] + lanes[1]);
+}
+
+/**
+ * @brief AVX2实现，每次取两个32字节向量
+ * 
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
+ */
+__attribute__((target("avx2"))) static uint64_t checksum_add_avx2(const uint8_t *p, size_t len, uint64_t sum)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i a = zero, b = zero, c = zero, d = zero;
+    for (; len >= 64; p += 64, len -= 64)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+        a = _mm256_add_epi64(a, _mm256_unpacklo_epi32(v0, zero));
+        b = _mm256_add_epi64(b, _mm256_unpackhi_epi32(v0, zero));
+        c = _mm256_add_epi64(c, _mm256_unpacklo_epi32(v1, zero));
+        d = _mm256_add_epi64(d, _mm256_unpackhi_epi32(v1, zero));
+    }
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), _mm256_add_epi64(c, d));
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, a);
+    _mm256_zeroupper(); //尾调用标量实现时编译器不会插入vzeroupper，不清除时此后的SSE代码会付出状态切换的代价
+    return checksum_add_scalar(p, len, sum + lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+/**
+ * @brief AVX2实现的拷贝并求和
+ * 
+ * @param dst 目的地址
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
+ */
+__attribute__((target("avx2"))) static uint64_t checksum_copy_avx2(uint8_t *dst, const uint8_t *p, size_t len, uint64_t sum)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i a = zero, b = zero, c = zero, d = zero;
+    for (; len >= 64; p += 64, dst += 64, len -= 64)
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+        _mm256_storeu_si256((__m256i *)dst, v0);
+        _mm256_storeu_si256((__m256i *)(dst + 32), v1);
+        a = _mm256_add_epi64(a, _mm256_unpacklo_epi32(v0, zero));
+        b = _mm256_add_epi64(b, _mm256_unpackhi_epi32(v0, zero));
+        c = _mm256_add_epi64(c, _mm256_unpacklo_epi32(v1, zero));
+        d = _mm256_add_epi64(d, _mm256_unpackhi_epi32(v1, zero));
+    }
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), _mm256_add_epi64(c, d));
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, a);
+    _mm256_zeroupper();
+    return checksum_copy_scalar(dst, p, len, sum + lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+/**
+ * @brief AVX-512实现，每次取两个64字节向量，只用到AVX512F
+ * 
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
+ */
+__attribute__((target("avx512f"))) static uint64_t checksum_add_avx512(const uint8_t *p, size_t len, uint64_t sum)
+{
+    __m512i zero = _mm512_setzero_si512();
+    __m512i a = zero, b = zero, c = zero, d = zero;
+    for (; len >= 128; p += 128, len -= 128)
+    {
+        __m512i v0 = _mm512_loadu_si512((const void *)p);
+        __m512i v1 = _mm512_loadu_si512((const void *)(p + 64));
+        a = _mm512_add_epi64(a, _mm512_unpacklo_epi32(v0, zero));
+        b = _mm512_add_epi64(b, _mm512_unpackhi_epi32(v0, zero));
+        c = _mm512_add_epi64(c, _mm512_unpacklo_epi32(v1, zero));
+        d = _mm512_add_epi64(d, _mm512_unpackhi_epi32(v1, zero));
+    }
+    a = _mm512_add_epi64(_mm512_add_epi64(a, b), _mm512_add_epi64(c, d));
+    sum += _mm512_reduce_add_epi64(a);
+    _mm256_zeroupper();
+    return checksum_add_scalar(p, len, sum);
+}
+
+/**
+ * @brief AVX-512实现的拷贝并求和
+ * 
+ * @param dst 目的地址
+ * @param p 数据
+ * @param len 长度
+ * @param sum 之前的累加和
+ * @return uint64_t 新的累加和
  */
-void buf_copy(buf_t *dst, buf_t *src)
+__attribute__((target("avx512f"))) static uint64_t checksum_copy_avx512(uint8_t *dst, const uint8_t *p, size_t len, uint64_t sum)
 {
-    buf_init(dst, src->len);
-    memcpy(dst->payload, src->payload, BUF_MAX_LEN);
+    __m512i zero = _mm512_setzero_si512();
+    __m512i a = zero, b = zero, c = zero, d = zero;
+    for (; len >= 128; p += 128, dst += 128, len -= 128)
+    {
+        __m512i v0 = _mm512_loadu_si512((const void *)p);
+        __m512i v1 = _mm512_loadu_si512((const void *)(p + 64));
+        _mm512_storeu_si512((void *)dst, v0);
+        _mm512_storeu_si512((void *)(dst + 64), v1);
+        a = _mm512_add_epi64(a, _mm512_unpacklo_epi32(v0, zero));
+        b = _mm512_add_epi64(b, _mm512_unpackhi_epi32(v0, zero));
+        c = _mm512_add_epi64(c, _mm512_unpacklo_epi32(v1, zero));
+        d = _mm512_add_epi64(d, _mm512_unpackhi_epi32(v1, zero));
+    }
+    a = _mm512_add_epi64(_mm512_add_epi64(a, b), _mm512_add_epi64(c, d));
+    sum += _mm512_reduce_add_epi64(a);
+    _mm256_zeroupper();
+    return checksum_copy_scalar(dst, p, len, sum);
+}
+#endif
+
+/**
+ * @brief 校验和的各种实现，按优先顺序排列
+ * 
+ */
+static const struct checksum_impl
+{
+    const char *name;   //名称
+    checksum_add_t add;   //累加函数
+    checksum_copy_t copy; //拷贝并累加的函数
+} checksum_impls[] = {
+#ifdef CHECKSUM_X86
+    {"avx512", checksum_add_avx512, checksum_copy_avx512},
+    {"avx2", checksum_add_avx2, checksum_copy_avx2},
+    {"sse2", checksum_add_sse2, checksum_copy_sse2},
+#endif
+    {"scalar", checksum_add_scalar, checksum_copy_scalar},
+};
+
+static const struct checksum_impl *checksum_impl; //正在使用的实现，第一次计算时选择
+
+/**
+ * @brief 当前CPU是否支持某种实现
+ * 
+ * @param name 实现的名称
+ * @return int 支持为1，否则为0
+ */
+static int checksum_supported(const char *name)
+{
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/**
+ * @brief 选择校验和的实现
+ * 
+ * @param name 实现的名称，如"avx2"、"scalar"；为NULL时按cpuid选择最快的
+ * @return int 成功为0，没有该实现或CPU不支持为-1
+ */
+int checksum16_use(const char *name)
+{
+    for (size_t i = 0; i < sizeof(checksum_impls) / sizeof(checksum_impls[0]); i++)
+        if ((name == NULL || strcmp(name, checksum_impls[i].name) == 0) && checksum_supported(checksum_impls[i].name))
+        {
+            checksum_impl = &checksum_impls[i];
+            return 0;
+        }
+    return -1;
+}
+
+/**
+ * @brief 正在使用的校验和实现
+ * 
+ * @return const char* 实现的名称
+ */
+const char *checksum16_impl()
+{
+    if (checksum_impl == NULL)
+        checksum16_use(NULL);
+    return checksum_impl->name;
 }
 
 /**
  * @brief 计算16位校验和
  *        1. 把首部看成以 16 位为单位的数字组成，依次进行二进制求和
- *           注意：求和时应将最高位的进位保存，所以加法应采用 32 位加法
- *        2. 将上述加法过程中产生的进位（最高位的进位）加到低 16 位
- *           采用 32 位加法时，即为将高 16 位与低 16 位相加，
- *           之后还要把该次加法最高位产生的进位加到低 16 位
+ *           注意：求和时应将最高位的进位保存，所以加法应采用 64 位加法
+ *        2. 将上述加法过程中产生的进位（最高位的进位）反复加到低 16 位
  *        3. 将上述的和取反，即得到校验和。  
+ *        长度为奇数时最后一个字节补0成一个字；求和由checksum16_use()选定的SIMD实现完成
  *        
  * @param buf 要计算的数据包
  * @param len 要计算的长度
@@ -82,19 +823,76 @@ void buf_copy(buf_t *dst, buf_t *src)
  */
 uint16_t checksum16(uint16_t *buf, int len)
 {
-    // TODO
-    uint32_t sum1 = 0;
-    uint16_t *p = buf;
-    
-    for(int i = 0;i < len/2;i++,p++){
-        sum1 += *p;
-        //printf("p:%x\n",*p);//test
-    }
-    if(len % 2 ==1){
-        sum1 += (*p << 8) & 0x00;
-    }
-    uint32_t sum2 = (sum1 & 0xffff)+(sum1 >> 16);
-    sum2 += sum2 >> 16;
-    uint16_t ans = ~sum2 & 0xffff;
-    return ans;
-}
\ No newline at end of file
+    if (checksum_impl == NULL)
+        checksum16_use(NULL);
+    return ~checksum_fold(checksum_impl->add((const uint8_t *)buf, len, 0)) & 0xffff;
+}
+
+/**
+ * @brief 计算部分和，用于分几段计算同一个校验和
+ * 
+ * @param buf 数据
+ * @param len 长度
+ * @param sum 之前的部分和
+ * @return uint32_t 新的部分和，已折叠到16位，未取反
+ */
+uint32_t checksum16_partial(const void *buf, size_t len, uint32_t sum)
+{
+    if (checksum_impl == NULL)
+        checksum16_use(NULL);
+    return checksum_fold(checksum_impl->add((const uint8_t *)buf, len, sum));
+}
+
+/**
+ * @brief 拷贝数据的同时计算部分和，数据只读一遍
+ * 
+ * @param dst 目的地址
+ * @param src 数据
+ * @param len 长度
+ * @param sum 之前的部分和
+ * @return uint32_t 新的部分和，已折叠到16位，未取反
+ */
+uint32_t checksum16_copy(void *dst, const void *src, size_t len, uint32_t sum)
+{
+    if (checksum_impl == NULL)
+        checksum16_use(NULL);
+    return checksum_fold(checksum_impl->copy((uint8_t *)dst, (const uint8_t *)src, len, sum));
+}
+
+/**
+ * @brief 把部分和折叠取反得到校验和
+ * 
+ * @param sum 部分和
+ * @return uint16_t 校验和
+ */
+uint16_t checksum16_finish(uint32_t sum)
+{
+    return ~checksum_fold(sum) & 0xffff;
+}
+
+/**
+ * @brief 计算没有选项的20字节IPv4头部的校验和，五个32位字直接相加
+ * 
+ * @param hdr IPv4头部
+ * @return uint16_t 校验和
+ */
+uint16_t checksum16_ip_hdr(const void *hdr)
+{
+    uint32_t w[5];
+    memcpy(w, hdr, sizeof(w));
+    return ~checksum_fold((uint64_t)w[0] + w[1] + w[2] + w[3] + w[4]) & 0xffff;
+}
+
+/**
+ * @brief 按RFC 1624增量更新校验和：HC' = ~(~HC + ~m + m')
+ * 
+ * @param check 原来的校验和
+ * @param old_word 改变前的16位字
+ * @param new_word 改变后的16位字
+ * @return uint16_t 新的校验和
+ */
+uint16_t checksum16_update16(uint16_t check, uint16_t old_word, uint16_t new_word)
+{
+    uint64_t sum = (uint16_t)~check + (uint16_t)~old_word + (uint64_t)new_word;
+    return ~checksum_fold(sum) & 0xffff;
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "net.h"
+#include "driver.h"
+#include "ethernet.h"
+#include "arp.h"
+
+/*
+ * arp表测试：在内存回环后端上运行完整的协议栈，把arp表容量设为很小的CAPACITY，
+ * 1. 随机插入大量邻居，不断触发CLOCK淘汰，每次淘汰都从索引中删除表项、把后面的探测链前移；
+ *    每一步之后表中每个有效表项都必须能查到且解析出自己的mac地址，不能有重复的ip；
+ * 2. 表满时先查找一半表项，再插入同样多的新邻居，被淘汰的应恰好是另一半未被查找过的表项；
+ * 3. 邻居句柄在表项被淘汰或mac地址改变后失效，只刷新超时时间时保持有效；
+ *    只经句柄发送的邻居在CLOCK淘汰中同样算作被使用，超时的表项经句柄发送时重新解析
+ */
+
+#define CAPACITY 16
+#define CHURN_ROUNDS 4000
+
+extern arp_entry_t *arp_table;
+extern int arp_table_size;
+
+static uint8_t last[ETHERNET_MTU + sizeof(ether_hdr_t)];
+static int frames;
+
+static void sink(const uint8_t *frame, uint16_t len, void *arg)
+{
+        memcpy(last, frame, len);
+        frames++;
+}
+
+static void make_neigh(int id, uint8_t *ip, uint8_t *mac)
+{
+        ip[0] = 10; ip[1] = id >> 16; ip[2] = id >> 8; ip[3] = id;
+        mac[0] = 0x02; mac[1] = 0; mac[2] = id >> 24; mac[3] = id >> 16; mac[4] = id >> 8; mac[5] = id;
+}
+
+/* 发出并丢弃发送队列中的帧，如初始化时的免费arp */
+static void drain()
+{
+        driver_flush();
+        driver_loop_consume(NULL, NULL, 64);
+}
+
+/* 经arp表发送一个IP数据包，返回发出的帧是否是发往mac的IP帧（否则为arp请求） */
+static int resolves(uint8_t *ip, const uint8_t *mac, arp_neigh_t *neigh)
+{
+        buf_t buf = {0};
+        buf_init(&buf, 20);
+        memset(buf.data, 0, 20);
+        if(neigh)
+                arp_out_neigh(&buf, ip, neigh);
+        else
+                arp_out(&buf, ip, NET_PROTOCOL_IP);
+        buf_free(&buf);
+        driver_flush();
+        frames = 0;
+        driver_loop_consume(sink, NULL, 64);
+        return frames == 1 && last[12] == 0x08 && last[13] == 0x00 && (mac == NULL || memcmp(last, mac, NET_MAC_LEN) == 0);
+}
+
+static int check_table(int round)
+{
+        for(int i = 0; i < arp_table_size; i++){
+                if(arp_table[i].state != ARP_VALID)
+                        continue;
+                for(int j = i + 1; j < arp_table_size; j++)
+                        if(arp_table[j].state == ARP_VALID && memcmp(arp_table[i].ip, arp_table[j].ip, NET_IP_LEN) == 0){
+                                printf("\e[0;31mround %d: entries %d and %d have the same ip\n", round, i, j);
+                                return 1;
+                        }
+                uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN];
+                memcpy(ip, arp_table[i].ip, NET_IP_LEN);
+                memcpy(mac, arp_table[i].mac, NET_MAC_LEN);
+                if(!resolves(ip, mac, NULL)){
+                        printf("\e[0;31mround %d: entry %d (%d.%d.%d.%d) not found in the index\n", round, i, ip[0], ip[1], ip[2], ip[3]);
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+static int test_churn()
+{
+        uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN];
+        uint64_t evictions = arp_get_stats()->evictions;
+        srand(1);
+        for(int round = 0; round < CHURN_ROUNDS; round++){
+                make_neigh(rand() % (4 * CAPACITY), ip, mac);
+                arp_update(ip, mac, ARP_VALID);
+                if(rand() % 2){ //查找一个随机的邻居，打乱访问位
+                        make_neigh(rand() % (4 * CAPACITY), ip, mac);
+                        resolves(ip, mac, NULL);
+                }
+                if(round % 16 == 0 && check_table(round))
+                        return 1;
+        }
+        if(arp_get_stats()->evictions == evictions){
+                printf("\e[0;31mchurn evicted nothing\n");
+                return 1;
+        }
+        return check_table(CHURN_ROUNDS);
+}
+
+static int test_clock()
+{
+        uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN];
+        arp_init(); //清空arp表，CLOCK指针回到开头
+        drain();
+        for(int i = 0; i < CAPACITY; i++){
+                make_neigh(1000 + i, ip, mac);
+                arp_update(ip, mac, ARP_VALID);
+        }
+        for(int i = 0; i < CAPACITY / 2; i++){
+                make_neigh(1000 + i, ip, mac);
+                resolves(ip, mac, NULL);
+        }
+        uint64_t evictions = arp_get_stats()->evictions;
+        for(int i = 0; i < CAPACITY / 2; i++){
+                make_neigh(2000 + i, ip, mac);
+                arp_update(ip, mac, ARP_VALID);
+        }
+        if(arp_get_stats()->evictions - evictions != CAPACITY / 2){
+                printf("\e[0;31mclock: %d evictions, expected %d\n", (int)(arp_get_stats()->evictions - evictions), CAPACITY / 2);
+                return 1;
+        }
+        for(int i = 0; i < CAPACITY; i++){
+                make_neigh(1000 + i, ip, mac);
+                if(resolves(ip, mac, NULL) != (i < CAPACITY / 2)){
+                        printf("\e[0;31mclock: neighbor %d %s\n", i, i < CAPACITY / 2 ? "was evicted although referenced" : "survived although unreferenced");
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+static int test_neigh()
+{
+        uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN], other[NET_MAC_LEN];
+        arp_neigh_t neigh = {0};
+        arp_init();
+        drain();
+        make_neigh(3000, ip, mac);
+        arp_update(ip, mac, ARP_VALID);
+        if(!resolves(ip, mac, &neigh) || neigh.entry == NULL){
+                printf("\e[0;31mneigh: handle not filled\n");
+                return 1;
+        }
+        arp_neigh_t saved = neigh;
+        arp_update(ip, mac, ARP_VALID); //只刷新超时时间
+        if(!resolves(ip, mac, &neigh) || neigh.entry != saved.entry || neigh.gen != saved.gen || saved.entry->gen != saved.gen){
+                printf("\e[0;31mneigh: refresh invalidated the handle\n");
+                return 1;
+        }
+        memcpy(other, mac, NET_MAC_LEN);
+        other[1] = 0xee;
+        arp_update(ip, other, ARP_VALID); //mac地址改变
+        if(saved.entry->gen == saved.gen || !resolves(ip, other, &neigh)){
+                printf("\e[0;31mneigh: mac change not picked up\n");
+                return 1;
+        }
+        saved = neigh;
+        for(int i = 0; i < 3 * CAPACITY; i++){ //只经句柄发送，每次插入之间都使用一次，CLOCK转过多圈仍不被淘汰
+                uint8_t ip2[NET_IP_LEN], mac2[NET_MAC_LEN];
+                make_neigh(5000 + i, ip2, mac2);
+                arp_update(ip2, mac2, ARP_VALID);
+                if(!resolves(ip, other, &neigh) || neigh.entry != saved.entry || neigh.gen != saved.gen){
+                        printf("\e[0;31mneigh: neighbor used only through its handle was evicted\n");
+                        return 1;
+                }
+        }
+        saved.entry->timeout -= ARP_TIMEOUT_SEC; //表项超时
+        uint64_t expired = arp_get_stats()->expired;
+        if(resolves(ip, other, &neigh) || arp_get_stats()->expired != expired + 1 || saved.entry->gen == saved.gen){
+                printf("\e[0;31mneigh: expired entry still used through its handle\n");
+                return 1;
+        }
+        arp_update(ip, other, ARP_VALID); //arp响应
+        if(!resolves(ip, other, &neigh) || neigh.gen == saved.gen){
+                printf("\e[0;31mneigh: expired neighbor not resolved again\n");
+                return 1;
+        }
+        saved = neigh;
+        for(int i = 0; i < 2 * CAPACITY; i++){ //访问位被清除后被淘汰
+                uint8_t ip2[NET_IP_LEN], mac2[NET_MAC_LEN];
+                make_neigh(4000 + i, ip2, mac2);
+                arp_update(ip2, mac2, ARP_VALID);
+        }
+        if(saved.entry->gen == saved.gen || resolves(ip, NULL, &neigh)){
+                printf("\e[0;31mneigh: handle still used after eviction\n");
+                return 1;
+        }
+        return 0;
+}
+
+int main()
+{
+        int fail = 0;
+        if(arp_set_max_entry(CAPACITY) < 0){
+                printf("\e[0;31marp_set_max_entry() failed\n");
+                return 1;
+        }
+        driver_select("loop");
+        net_init();
+        drain();
+        if(arp_table_size != CAPACITY || arp_set_max_entry(2 * CAPACITY) == 0){
+                printf("\e[0;31mcapacity %d, expected %d and fixed after init\n", arp_table_size, CAPACITY);
+                return 1;
+        }
+        fail |= test_churn();
+        if(!fail)
+                printf("\e[0;34mchurn checked\n");
+        fail |= test_clock();
+        if(!fail)
+                printf("\e[0;34mclock eviction checked\n");
+        fail |= test_neigh();
+        if(!fail){
+                printf("\e[0;34mneighbor handles checked\n");
+                printf("\e[1;32mArp cache check passed\n");
+        }
+        return fail;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+/*
+ * 缓冲池测试：
+ * 1. 克隆只增加引用计数，不拷贝；经一个持有者添加协议头或改写数据时写时复制，另一个持有者的数据保持不变；
+ * 2. 同一个缓冲区可以有任意多个持有者，都不退化为拷贝；全部释放后缓冲区回到缓冲池；
+ * 3. 释放与buf_t放在哪里无关：把buf_t拷贝到别处后从别处释放，缓冲区同样回到缓冲池
+ */
+
+#define LEN 100
+#define MANY_CLONES 32
+
+static uint32_t in_use()
+{
+        return buf_pool_get_stats()[BUF_CLASS_SMALL].in_use;
+}
+
+static int test_cow()
+{
+        buf_t a = {0}, b = {0};
+        uint8_t orig[LEN];
+        uint32_t used = in_use();
+        const buf_pool_stats_t *st = &buf_pool_get_stats()[BUF_CLASS_SMALL];
+        uint64_t clones = st->clones, cow = st->cow_copies;
+        buf_init(&a, LEN);
+        for(int i = 0; i < LEN; i++)
+                a.data[i] = orig[i] = i;
+        if(buf_clone(&b, &a) < 0 || b.data != a.data || in_use() != used + 1 || st->clones != clones + 1){
+                printf("\e[0;31mcow: clone copied the data\n");
+                return 1;
+        }
+        if(buf_add_header(&b, 8) < 0 || in_use() != used + 2 || st->cow_copies != cow + 1){
+                printf("\e[0;31mcow: adding a header to a shared buffer did not copy it\n");
+                return 1;
+        }
+        memset(b.data, 0xee, b.len); //改写新的头部与数据
+        if(memcmp(a.data, orig, LEN) != 0 || a.len != LEN || buf_headroom(&b) != buf_headroom(&a) - 8){
+                printf("\e[0;31mcow: writing through one holder changed the other\n");
+                return 1;
+        }
+        if(buf_make_writable(&a) < 0 || st->cow_copies != cow + 1){
+                printf("\e[0;31mcow: sole holder copied again\n");
+                return 1;
+        }
+        buf_clone(&b, &a); //b放弃自己的副本，再次与a共享
+        if(b.data != a.data || in_use() != used + 1 || buf_make_writable(&a) < 0 || a.data == b.data ||
+           memcmp(a.data, orig, LEN) != 0 || memcmp(b.data, orig, LEN) != 0){
+                printf("\e[0;31mcow: buf_make_writable() did not give a private copy\n");
+                return 1;
+        }
+        a.data[0] = 0xee;
+        if(b.data[0] != orig[0]){
+                printf("\e[0;31mcow: writing after buf_make_writable() changed the other holder\n");
+                return 1;
+        }
+        buf_free(&a);
+        buf_free(&b);
+        if(in_use() != used){
+                printf("\e[0;31mcow: %d buffers leaked\n", (int)(in_use() - used));
+                return 1;
+        }
+        return 0;
+}
+
+static int test_many()
+{
+        buf_t src = {0}, clones[MANY_CLONES] = {{0}};
+        uint32_t used = in_use();
+        uint64_t cow = buf_pool_get_stats()[BUF_CLASS_SMALL].cow_copies;
+        buf_init(&src, LEN);
+        memset(src.data, 0x5a, LEN);
+        for(int i = 0; i < MANY_CLONES; i++)
+                if(buf_clone(&clones[i], i ? &clones[i - 1] : &src) < 0 || clones[i].data != src.data){
+                        printf("\e[0;31mmany: clone %d copied the data\n", i);
+                        return 1;
+                }
+        buf_free(&src);
+        for(int i = 0; i < MANY_CLONES - 1; i++)
+                buf_free(&clones[i]);
+        if(in_use() != used + 1 || buf_make_writable(&clones[MANY_CLONES - 1]) < 0 ||
+           buf_pool_get_stats()[BUF_CLASS_SMALL].cow_copies != cow){
+                printf("\e[0;31mmany: last holder does not own the buffer alone\n");
+                return 1;
+        }
+        buf_free(&clones[MANY_CLONES - 1]);
+        if(in_use() != used){
+                printf("\e[0;31mmany: %d buffers leaked\n", (int)(in_use() - used));
+                return 1;
+        }
+        return 0;
+}
+
+static int test_moved()
+{
+        uint32_t used = in_use();
+        buf_t *a = calloc(1, sizeof(buf_t)), *b = calloc(1, sizeof(buf_t));
+        buf_init(a, LEN);
+        buf_clone(b, a);
+        buf_t moved = *a; //buf_t搬到别处，原来的位置清掉
+        memset(a, 0xa5, sizeof(*a));
+        free(a);
+        buf_free(&moved);
+        if(in_use() != used + 1){
+                printf("\e[0;31mmoved: releasing a moved buf did not drop its reference\n");
+                return 1;
+        }
+        buf_free(b);
+        free(b);
+        if(in_use() != used){
+                printf("\e[0;31mmoved: %d buffers leaked\n", (int)(in_use() - used));
+                return 1;
+        }
+        return 0;
+}
+
+int main()
+{
+        int fail = 0;
+        fail |= test_cow();
+        if(!fail)
+                printf("\e[0;34mcopy on write checked\n");
+        fail |= test_many();
+        if(!fail)
+                printf("\e[0;34mmany holders checked\n");
+        fail |= test_moved();
+        if(!fail){
+                printf("\e[0;34mmoved holders checked\n");
+                printf("\e[1;32mBuffer check passed\n");
+        }
+        return fail;
+}
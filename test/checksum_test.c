@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+/*
+ * 校验和测试：每种CPU支持的实现都与逐个16位字求和的参考实现比较，
+ * 覆盖0到1600的所有长度与0到63的所有起始偏移、最大的数据包长度，以及全0xff等进位最多的数据；
+ * 拷贝并求和的结果与拷贝的数据都要正确，数据分成两段（包括从奇数偏移开始的第二段）求部分和后合并也要得到同样的校验和；
+ * 增量更新的校验和在一个20字节头部中反复改写各个16位字，每一步都与重新计算的结果比较，
+ * 包括RFC 1624中新校验和为0x0000、改写的字在0x0000与0xffff（反码的两个零）之间变化的情况
+ */
+
+#define MAX_LEN 1600
+#define MAX_OFF 64
+#define UPDATE_ROUNDS 100000
+#define HDR_LEN 20
+#define CHECK_WORD 5 //头部中校验和所在的16位字，与IPv4头部相同
+
+static uint8_t data[MAX_OFF + BUF_MAX_LEN];
+static uint8_t copy[MAX_OFF + BUF_MAX_LEN];
+
+static uint16_t reference(const uint8_t *p, int len)
+{
+        uint32_t sum = 0;
+        for(int i = 0; i + 1 < len; i += 2){
+                uint16_t w;
+                memcpy(&w, p + i, 2);
+                sum += w;
+                sum = (sum & 0xffff) + (sum >> 16);
+        }
+        if(len & 1){
+                uint16_t w = 0;
+                memcpy(&w, p + len - 1, 1);
+                sum += w;
+                sum = (sum & 0xffff) + (sum >> 16);
+        }
+        return ~sum & 0xffff;
+}
+
+static int check(const char *impl, const char *pattern)
+{
+        for(int off = 0; off < MAX_OFF; off++)
+                for(int len = 0; len <= MAX_LEN; len++){
+                        uint8_t *p = data + off;
+                        uint16_t want = reference(p, len);
+                        uint16_t got = checksum16((uint16_t *)p, len);
+                        if(got != want){
+                                printf("\e[0;31m%s: %s data, offset %d length %d: got %04x expected %04x\n",
+                                        impl, pattern, off, len, got, want);
+                                return 1;
+                        }
+                }
+        for(int off = 0; off < MAX_OFF; off++)
+                for(int len = 0; len <= MAX_LEN; len += 7){
+                        uint8_t *p = data + off, *q = copy + (off * 5 % MAX_OFF);
+                        uint16_t want = reference(p, len);
+                        memset(copy, 0, sizeof(copy));
+                        if(checksum16_finish(checksum16_copy(q, p, len, 0)) != want || memcmp(q, p, len) != 0){
+                                printf("\e[0;31m%s: %s data, copy at offset %d length %d differs\n", impl, pattern, off, len);
+                                return 1;
+                        }
+                        int split = len * off / MAX_OFF;
+                        uint16_t second = checksum16_partial(p + split, len - split, 0);
+                        if(split & 1)
+                                second = second << 8 | second >> 8;
+                        if(checksum16_finish(checksum16_partial(p, split, 0) + second) != want){
+                                printf("\e[0;31m%s: %s data, offset %d length %d split at %d differs\n", impl, pattern, off, len, split);
+                                return 1;
+                        }
+                }
+        for(int off = 0; off < 2; off++){
+                uint8_t *p = data + off;
+                if(checksum16((uint16_t *)p, BUF_MAX_LEN - off) != reference(p, BUF_MAX_LEN - off)){
+                        printf("\e[0;31m%s: %s data, offset %d full length differs\n", impl, pattern, off);
+                        return 1;
+                }
+        }
+        for(int off = 0; off < MAX_OFF; off++){
+                uint8_t *p = data + off;
+                if(checksum16_ip_hdr(p) != reference(p, 20)){
+                        printf("\e[0;31m%s: %s data, 20-byte header at offset %d differs\n", impl, pattern, off);
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+static uint16_t hdr_word(const uint8_t *hdr, int i)
+{
+        uint16_t w;
+        memcpy(&w, hdr + 2 * i, 2);
+        return w;
+}
+
+static void set_hdr_word(uint8_t *hdr, int i, uint16_t w)
+{
+        memcpy(hdr + 2 * i, &w, 2);
+}
+
+/* 校验和字段清零后重新计算 */
+static uint16_t recompute(uint8_t *hdr)
+{
+        set_hdr_word(hdr, CHECK_WORD, 0);
+        return reference(hdr, HDR_LEN);
+}
+
+/* 把第i个字改为w，增量更新校验和，并与重新计算的结果比较 */
+static int update_word(uint8_t *hdr, int i, uint16_t w, int round)
+{
+        uint16_t check = hdr_word(hdr, CHECK_WORD), old = hdr_word(hdr, i);
+        uint16_t got = checksum16_update16(check, old, w);
+        set_hdr_word(hdr, i, w);
+        uint16_t want = recompute(hdr);
+        set_hdr_word(hdr, CHECK_WORD, got);
+        if(got != want){
+                printf("\e[0;31mupdate round %d: word %d %04x -> %04x, checksum %04x: got %04x expected %04x\n",
+                        round, i, old, w, check, got, want);
+                return 1;
+        }
+        return 0;
+}
+
+static int check_update()
+{
+        uint8_t hdr[HDR_LEN];
+        int zero = 0;
+        if(checksum16_update16(0xdd2f, 0x5555, 0x3285) != 0x0000){ //RFC 1624第4节的例子，按式2会得到0xffff
+                printf("\e[0;31mupdate: RFC 1624 example gives %04x\n", checksum16_update16(0xdd2f, 0x5555, 0x3285));
+                return 1;
+        }
+        srand(2);
+        for(int j = 0; j < HDR_LEN; j++)
+                hdr[j] = rand();
+        hdr[0] = 0x45; //与IPv4头部一样不全为0，重新计算的校验和不会是0xffff
+        set_hdr_word(hdr, CHECK_WORD, recompute(hdr));
+        for(int round = 0; round < UPDATE_ROUNDS; round++){
+                uint8_t tmp[HDR_LEN];
+                uint16_t w;
+                int i;
+                do
+                        i = rand() % (HDR_LEN / 2);
+                while(i == 0 || i == CHECK_WORD); //第0个字保持不变
+                switch(round % 4){
+                case 0: //其余各字之和的反码，使新的和为0xffff、校验和为0x0000
+                        memcpy(tmp, hdr, HDR_LEN);
+                        set_hdr_word(tmp, i, 0);
+                        w = recompute(tmp);
+                        break;
+                case 1: //在反码的两个零之间变化，上一轮的校验和为0x0000时即RFC 1624第3节的情况
+                        w = hdr_word(hdr, i) == 0 ? 0xffff : 0;
+                        break;
+                default:
+                        w = rand();
+                }
+                if(update_word(hdr, i, w, round))
+                        return 1;
+                zero += hdr_word(hdr, CHECK_WORD) == 0;
+        }
+        if(zero < UPDATE_ROUNDS / 4){
+                printf("\e[0;31mupdate: only %d of %d updates gave checksum 0x0000\n", zero, UPDATE_ROUNDS);
+                return 1;
+        }
+        return 0;
+}
+
+int main()
+{
+        const char *impls[] = {"scalar", "sse2", "avx2", "avx512"};
+        int fail = 0;
+        printf("\e[0;34mDefault implementation: %s\n", checksum16_impl());
+        for(int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++){
+                if(checksum16_use(impls[i]) < 0){
+                        printf("\e[0;34m%s not supported, skipped\n", impls[i]);
+                        continue;
+                }
+                srand(1);
+                for(int j = 0; j < sizeof(data); j++)
+                        data[j] = rand();
+                fail |= check(impls[i], "random");
+                memset(data, 0xff, sizeof(data));
+                fail |= check(impls[i], "0xff");
+                if(!fail)
+                        printf("\e[0;34m%s checked\n", impls[i]);
+        }
+        fail |= check_update();
+        if(!fail)
+                printf("\e[0;34mincremental update checked\n");
+        if(fail == 0){
+                printf("\e[1;32mChecksum check passed\n");
+        }
+        return fail;
+}
@@ -14,7 +14,8 @@ char* print_ip(uint8_t *ip);
 char* print_mac(uint8_t *mac);
 void fprint_buf(FILE* f, buf_t* buf);
 
-arp_entry_t arp_table[ARP_MAX_ENTRY];
+arp_entry_t *arp_table;
+int arp_table_size;
 arp_buf_t arp_buf;
 
 void arp_update(uint8_t *ip, uint8_t *mac, arp_state_t state)
@@ -31,6 +32,12 @@ void arp_in(buf_t *buf)
         fprint_buf(arp_fout,buf);
 }
 
+void arp_in_vec(buf_t **bufs, int n)
+{
+        for(int i = 0; i < n; i++)
+                arp_in(bufs[i]);
+}
+
 void arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
 {
         fprintf(arp_fout,"arp_out\t");
@@ -39,6 +46,11 @@ void arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
         fprint_buf(arp_fout,buf);
 }
 
+void arp_out_neigh(buf_t *buf, uint8_t *ip, arp_neigh_t *neigh)
+{
+        arp_out(buf,ip,NET_PROTOCOL_IP);
+}
+
 void arp_init()
 {
         fprintf(arp_fout,"arp_init\n");
@@ -36,7 +36,7 @@ int driver_recv(buf_t *buf)
                 // printf("meet end of file\n");
                 return 0;
         }else if (ret == 1){
-                buf_init(buf,pkt_hdr->len);
+                buf_init_frame(buf,pkt_hdr->len);
                 memcpy(buf->data, pkt_data, pkt_hdr->len);
                 return pkt_hdr->len;
         }else{
@@ -45,13 +45,52 @@ int driver_recv(buf_t *buf)
         }
 }
 
+int driver_recv_batch(buf_t *bufs, int n)
+{
+        int i = 0;
+        for(; i < n; i++){
+                int ret = driver_recv(&bufs[i]);
+                if(ret < 0)
+                        return i ? i : -1;
+                if(ret == 0)
+                        break;
+        }
+        return i;
+}
+
+int driver_recv_zc(buf_t *bufs, int n)
+{
+        return driver_recv_batch(bufs, n);
+}
+
+void driver_release()
+{
+}
+
 int driver_send(buf_t *buf)
 {
         struct pcap_pkthdr header;
+        buf_t frame = {0};
         memset(&header.ts,0,sizeof(header.ts));
+        if(buf->next){
+                buf_copy(&frame,buf);
+                buf = &frame;
+        }
         header.caplen = buf->len;
         header.len = buf->len;
         pcap_dump((u_char *)pdump,&header,buf->data);
+        if(buf == &frame)
+                buf_free(&frame);
+        return 0;
+}
+
+int driver_flush()
+{
+        return 0;
+}
+
+int driver_fds(int *fds, int max)
+{
         return 0;
 }
 
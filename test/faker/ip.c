@@ -19,6 +19,17 @@ void ip_in(buf_t *buf)
         fprint_buf(ip_fout, buf);
 }
 
+void ip_in_vec(buf_t **bufs, int n)
+{
+        for(int i = 0; i < n; i++)
+                ip_in(bufs[i]);
+}
+
+int ip_early_demux(buf_t *buf)
+{
+        return 0;
+}
+
 void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf)
 {
         fprintf(ip_fout,"ip_fragment_out:\t");        
@@ -16,6 +16,17 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
         fprint_buf(udp_fout, buf);
 }
 
+void udp_in_vec(buf_t **bufs, uint8_t (*src_ips)[NET_IP_LEN], int n)
+{
+        for(int i = 0; i < n; i++)
+                udp_in(bufs[i], src_ips[i]);
+}
+
+udp_entry_t *udp_demux(buf_t *buf, uint8_t *src_ip)
+{
+        return NULL;
+}
+
 void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
 {
         fprintf(udp_fout,"udp_out:\t");
@@ -28,7 +28,8 @@ FILE *udp_fout;
 FILE *out_log;
 FILE *demo_log;
 
-extern arp_entry_t arp_table[ARP_MAX_ENTRY];
+extern arp_entry_t *arp_table;
+extern int arp_table_size;
 extern arp_buf_t arp_buf;
 
 char* state[16] = {
@@ -79,8 +80,10 @@ void fprint_buf(FILE* f, buf_t* buf)
         if(buf == 0){
                 fprintf(f,"(null)\n");
         }else{
-                for(int i = 0; i < buf->len; i++){
-                        fprintf(f," %02x",buf->data[i]);
+                for(buf_t *seg = buf; seg; seg = seg->next){
+                        for(int i = 0; i < seg->len; i++){
+                                fprintf(f," %02x",seg->data[i]);
+                        }
                 }
                 fprintf(f,"\n");
         }
@@ -89,7 +92,7 @@ void fprint_buf(FILE* f, buf_t* buf)
 void log_tab_buf(){
         fprintf(arp_log_f, "<====== arp table =======>\n");
         fprintf(arp_log_f, "state  \ttimeout/10^7\tip\t\t\tmac\n");
-        for(int i = 0; i < ARP_MAX_ENTRY; i++){
+        for(int i = 0; i < arp_table_size; i++){
                 if(arp_table[i].state != ARP_INVALID){
                         fprintf(arp_log_f, "%s\t%ld\t\t%s\t\t%s\n",
                                 state[arp_table[i].state],
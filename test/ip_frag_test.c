@@ -19,8 +19,8 @@ int main()
                 return 0;
         }
         arp_fout = control_flow;
-        char * p = buf.payload + 1000;
-        buf.data = p;
+        buf_init(&buf, BUF_MAX_LEN - 1000);
+        char * p = buf.data;
         buf.len = 0;
         char c;
         while(fread(&c,1,1,in)){
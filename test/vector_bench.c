@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "net.h"
+#include "driver.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "udp.h"
+
+/*
+ * 向量处理测试：比较逐个处理（ethernet_in逐层调用）与向量处理（整批依次经过各层）的接收吞吐。
+ * 单线程交替向内存回环后端注入一批UDP帧与运行协议栈，没有发生器线程，单核机器上结果也稳定；
+ * 两种方式以小段交替运行，各自累计处理的数据包数与用时。
+ * 发往的目的端口轮流取自若干个已打开的端口。
+ * 用法: ./vector_bench [每种方式的秒数] [负载长度] [端口数]
+ */
+
+#define BENCH_PORT 60000
+#define BENCH_MAX_PORTS UDP_MAX_HANDLER
+
+static const uint8_t peer_mac[] = {0x02,0x00,0x00,0x00,0x00,0x01};
+static const uint8_t peer_ip[] = {192,168,174,1};
+static const uint8_t my_mac[] = DRIVER_IF_MAC;
+static const uint8_t my_ip[] = DRIVER_IF_IP;
+
+static uint64_t rx_handled;
+
+static uint8_t frames[BENCH_MAX_PORTS][ETHERNET_MTU + sizeof(ether_hdr_t)];
+static int frame_len;
+
+void handler(udp_entry_t *entry, uint8_t *src_ip, uint16_t src_port, buf_t *buf)
+{
+        (void)entry;
+        (void)src_ip;
+        (void)src_port;
+        (void)buf;
+        rx_handled++;
+}
+
+static uint16_t sum16(const uint8_t *p, int len, uint32_t sum)
+{
+        for(int i = 0; i + 1 < len; i += 2)
+                sum += (p[i] << 8) | p[i + 1];
+        if(len & 1)
+                sum += p[len - 1] << 8;
+        while(sum >> 16)
+                sum = (sum & 0xffff) + (sum >> 16);
+        return ~sum & 0xffff;
+}
+
+static void build_udp_frame(uint8_t *p, int payload_len, int port)
+{
+        int udp_len = 8 + payload_len;
+        memcpy(p, my_mac, 6);
+        memcpy(p + 6, peer_mac, 6);
+        p[12] = 0x08; p[13] = 0x00;
+
+        uint8_t *ip = p + 14;
+        memset(ip, 0, 20);
+        ip[0] = 0x45;
+        ip[2] = (20 + udp_len) >> 8; ip[3] = 20 + udp_len;
+        ip[8] = 64;
+        ip[9] = NET_PROTOCOL_UDP;
+        memcpy(ip + 12, peer_ip, 4);
+        memcpy(ip + 16, my_ip, 4);
+        uint16_t cs = sum16(ip, 20, 0);
+        ip[10] = cs >> 8; ip[11] = cs;
+
+        uint8_t *udp = ip + 20;
+        udp[0] = 5555 >> 8; udp[1] = 5555 & 0xff;
+        udp[2] = port >> 8; udp[3] = port & 0xff;
+        udp[4] = udp_len >> 8; udp[5] = udp_len;
+        udp[6] = udp[7] = 0;
+        for(int i = 0; i < payload_len; i++)
+                udp[8 + i] = i;
+        uint32_t pseudo = (peer_ip[0] << 8 | peer_ip[1]) + (peer_ip[2] << 8 | peer_ip[3]) +
+                          (my_ip[0] << 8 | my_ip[1]) + (my_ip[2] << 8 | my_ip[3]) +
+                          NET_PROTOCOL_UDP + udp_len;
+        cs = sum16(udp, udp_len, pseudo);
+        udp[6] = cs >> 8; udp[7] = cs;
+        frame_len = 14 + 20 + udp_len;
+}
+
+static double now_sec()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define CHUNK_POLLS 256 //两种方式交替运行，每段的轮询次数；宿主机的干扰因此平均落在两种方式上
+
+static uint64_t chunk(int vector, int ports, int *next, double *elapsed)
+{
+        ethernet_set_vector(vector);
+        rx_handled = 0;
+        double start = now_sec();
+        for(int i = 0; i < CHUNK_POLLS; i++){
+                for(int j = 0; j < ETHERNET_BURST; j++, *next = (*next + 1) % ports)
+                        driver_loop_produce(frames[*next], frame_len);
+                net_poll();
+        }
+        *elapsed += now_sec() - start;
+        return rx_handled;
+}
+
+static void report(const char *name, uint64_t packets, double elapsed, const net_demux_stats_t *st)
+{
+        printf("%s: %llu packets, %.0f pps, fast path %llu of %llu\n", name,
+               (unsigned long long)packets, packets / elapsed,
+               (unsigned long long)st->hits, (unsigned long long)(st->hits + st->misses));
+}
+
+int main(int argc, char *argv[])
+{
+        double seconds = argc > 1 ? atof(argv[1]) : 2;
+        int payload_len = argc > 2 ? atoi(argv[2]) : 64;
+        int ports = argc > 3 ? atoi(argv[3]) : 4;
+        if(payload_len > ETHERNET_MTU - 28)
+                payload_len = ETHERNET_MTU - 28;
+        if(ports < 1)
+                ports = 1;
+        if(ports > BENCH_MAX_PORTS)
+                ports = BENCH_MAX_PORTS;
+
+        driver_select("loop");
+        net_init();
+        for(int i = 0; i < ports; i++){
+                udp_open(BENCH_PORT + i, handler);
+                build_udp_frame(frames[i], payload_len, BENCH_PORT + i);
+        }
+
+        printf("payload %d bytes, frame %d bytes, %d ports, burst %d\n", payload_len, frame_len, ports, ETHERNET_BURST);
+        uint64_t packets[2] = {0};
+        double elapsed[2] = {0};
+        int next = 0;
+        double end = now_sec() + 2 * seconds;
+        while(now_sec() < end)
+                for(int vector = 0; vector < 2; vector++)
+                        packets[vector] += chunk(vector, ports, &next, &elapsed[vector]);
+        report("scalar", packets[0], elapsed[0], &net_if_current->demux_stats); //两种方式各有一组计数
+        report("vector", packets[1], elapsed[1], &net_if_current->vector_stats);
+        printf("vector/scalar: %.3f (pps ratio)\n", (packets[1] / elapsed[1]) / (packets[0] / elapsed[0]));
+        return 0;
+}